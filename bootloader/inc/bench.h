@@ -0,0 +1,91 @@
+/**
+ * @file bench.h
+ * @brief Bootloader cycle measurement interface.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+/**
+ * @brief Measured code regions.
+ *
+ * Keep in sync with the slot names in bench.c.
+ */
+typedef enum {
+    BENCH_LOAD,         // whole load_data() transfer
+    BENCH_RX_WAIT,      // waiting for a frame to arrive
+    BENCH_FLASH_ERASE,  // flash_erase_page()
+    BENCH_FLASH_WRITE,  // flash_write() of one page
+    BENCH_PAGE_COMPARE, // comparing a received page with flash
+    BENCH_BOOT_LOAD,    // copying or inflating the firmware into the boot RAM
+    BENCH_DECRYPT,      // decrypting a received frame
+    BENCH_DIGEST,       // hashing the programmed image
+    BENCH_KEY_SCHEDULE, // expanding the AES key
+    BENCH_BOOT_VERIFY,  // hashing the stored firmware again before a boot
+    BENCH_ERASE_AHEAD,  // erasing the pages of a transfer before it starts
+    BENCH_SLOTS
+} bench_slot_t;
+
+#ifdef BENCHMARK
+
+// Function Prototypes
+
+/**
+ * @brief Start the cycle counter.
+ *
+ * SysTick counts down from 2^24 at the system clock and its wraps are counted
+ * in software, so measurements up to 2^32 cycles are possible.
+ */
+void bench_init(void);
+
+/**
+ * @brief Stop the cycle counter and release the SysTick interrupt.
+ */
+void bench_deinit(void);
+
+/**
+ * @brief Read the cycle counter.
+ *
+ * @return the number of system clock cycles since bench_init().
+ */
+uint32_t bench_now(void);
+
+/**
+ * @brief Add a measurement to a slot.
+ *
+ * @param slot is the measured region.
+ * @param start is the bench_now() value at the start of the region.
+ */
+void bench_record(bench_slot_t slot, uint32_t start);
+
+/**
+ * @brief Send all measurements to the host and clear them.
+ *
+ * The report is the system clock frequency (4B), the number of slots (1B) and
+ * for each slot its NUL-terminated name, number of measurements (4B), total
+ * cycles (8B) and longest measurement (4B). Integers are little endian.
+ *
+ * @param uart is the base address of the UART interface to write to.
+ */
+void bench_report(uint32_t uart);
+
+#define BENCH_START(var)        uint32_t var = bench_now()
+#define BENCH_STOP(slot, var)   bench_record(slot, var)
+
+#else
+
+#define BENCH_START(var)
+#define BENCH_STOP(slot, var)
+
+#endif // BENCHMARK
+
+#endif // BENCH_H
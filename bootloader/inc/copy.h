@@ -0,0 +1,32 @@
+/**
+ * @file copy.h
+ * @brief Bootloader block copy interface.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef COPY_H
+#define COPY_H
+
+#include <stdint.h>
+
+// Function Prototypes
+
+/**
+ * @brief Copy a block between word-aligned buffers.
+ *
+ * Copies 32 bytes per LDM/STM pair, then single words, then the tail bytes
+ * (copy.S). The buffers must not overlap.
+ *
+ * @param dst is a pointer to the destination, word aligned.
+ * @param src is a pointer to the source, word aligned.
+ * @param len is the number of bytes to copy.
+ */
+void copy_aligned(void *dst, const void *src, uint32_t len);
+
+#endif // COPY_H
@@ -0,0 +1,42 @@
+/**
+ * @file crypto_bench.h
+ * @brief Bootloader crypto microbenchmark interface.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef CRYPTO_BENCH_H
+#define CRYPTO_BENCH_H
+
+#include <stdint.h>
+
+#define CRYPTO_BENCH_SMALL 1024     // one frame
+#define CRYPTO_BENCH_LARGE 16384    // a whole firmware image
+#define CRYPTO_BENCH_HUGE  65536    // hashes only, read from flash
+#define CRYPTO_BENCH_FLASH ((const uint8_t *)0x00010000)
+
+// Function Prototypes
+
+/**
+ * @brief Time every vendored cipher and hash implementation and send a table.
+ *
+ * Each implementation is set up once (key schedule or hash init) and then run
+ * over CRYPTO_BENCH_SMALL and CRYPTO_BENCH_LARGE bytes, timed with bench_now().
+ * The table is plain text, one implementation per line, with the setup and
+ * run cycles and the cycles per byte of the large run. The hashes are then
+ * timed over CRYPTO_BENCH_HUGE bytes of flash, and sha256_asm is checked
+ * against known answers and against BearSSL. The report ends with a NUL.
+ *
+ * @param uart is the base address of the UART interface to write to.
+ * @param buf is a pointer to a scratch buffer of at least CRYPTO_BENCH_LARGE
+ * bytes, word aligned.
+ * @param size is the size of the scratch buffer.
+ */
+void crypto_bench_run(uint32_t uart, uint8_t *buf, uint32_t size);
+
+#endif // CRYPTO_BENCH_H
@@ -0,0 +1,68 @@
+/**
+ * @file crypto_select.h
+ * @brief Selection of the BearSSL backends used for firmware updates.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef CRYPTO_SELECT_H
+#define CRYPTO_SELECT_H
+
+#include "bearssl_block.h"
+#include "bearssl_hash.h"
+
+/*
+ * BearSSL ships several implementations of the same primitives, trading speed,
+ * code size and constant-time behaviour, and SHA-256 also has one of our own.
+ * The Makefile picks one of each with CRYPTO_AES, CRYPTO_POLY1305 and
+ * CRYPTO_SHA256, and links only the objects it needs. Compare them on the
+ * target with `make crypto_bench` (see crypto_bench.h).
+ *
+ *      CRYPTO_AES_BIG          table based, the fastest without hardware AES
+ *      CRYPTO_AES_SMALL        one 256B table, slower
+ *      CRYPTO_AES_CT           bitsliced, constant time
+ *
+ *      CRYPTO_POLY1305_CTMUL   32x32->64 multiplies, constant time on the M4
+ *      CRYPTO_POLY1305_CTMUL32 32x32->32 multiplies, for cores with a slow
+ *                              long multiply
+ *
+ *      CRYPTO_SHA256_BEARSSL   the portable C of sha2small.c
+ *      CRYPTO_SHA256_ASM       the Cortex-M4 assembly of sha256_block.S, on
+ *                              the same br_sha256_context (see sha256.h)
+ *
+ * ChaCha20 has a single portable implementation.
+ */
+#if defined(CRYPTO_AES_SMALL)
+typedef br_aes_small_cbcdec_keys crypto_cbcdec_keys;
+#define crypto_cbcdec_vtable br_aes_small_cbcdec_vtable
+#elif defined(CRYPTO_AES_CT)
+typedef br_aes_ct_cbcdec_keys crypto_cbcdec_keys;
+#define crypto_cbcdec_vtable br_aes_ct_cbcdec_vtable
+#else
+typedef br_aes_big_cbcdec_keys crypto_cbcdec_keys;
+#define crypto_cbcdec_vtable br_aes_big_cbcdec_vtable
+#endif
+
+#if defined(CRYPTO_POLY1305_CTMUL32)
+#define crypto_poly1305_run br_poly1305_ctmul32_run
+#else
+#define crypto_poly1305_run br_poly1305_ctmul_run
+#endif
+
+#define crypto_chacha20_run br_chacha20_ct_run
+
+#if defined(CRYPTO_SHA256_ASM)
+#include "sha256.h"
+#define crypto_sha256_update sha256_update
+#define crypto_sha256_out    sha256_out
+#else
+#define crypto_sha256_update br_sha256_update
+#define crypto_sha256_out    br_sha256_out
+#endif
+
+#endif // CRYPTO_SELECT_H
@@ -16,12 +16,17 @@
 
 #include <stdint.h>
 
+#include "ramfunc.h"
+
 // Flash properties
 #define FLASH_START        ((uint32_t)0x00000000)
 #define FLASH_PAGE_SIZE    ((uint32_t)0x00000400)
 #define FLASH_END          ((uint32_t)0x00040000)
+#define FLASH_FWB_WORDS    32      // words in the flash write buffer
 
 // Function Prototypes
+// The flash driver runs from SRAM (RAMFUNC) so that it does not stall on its
+// own flash operations.
 
 /**
  * @brief Erases a block of flash.
@@ -30,7 +35,7 @@
  * @return 0 on success, or -1 if an invalid block address was specified or the 
  * block is write-protected.
  */
-int32_t flash_erase_page(uint32_t addr);
+RAMFUNC int32_t flash_erase_page(uint32_t addr);
 
 /**
  * @brief Writes a word to flash.
@@ -42,19 +47,34 @@ int32_t flash_erase_page(uint32_t addr);
  * @param addr is the location to write to.
  * @return 0 on success, or -1 if an error occurs.
  */
-int32_t flash_write_word(uint32_t data, uint32_t addr);
+RAMFUNC int32_t flash_write_word(uint32_t data, uint32_t addr);
+
+/**
+ * @brief Writes a block of words to flash through the flash write buffer.
+ * 
+ * This function fills the 32-word flash write buffer (FWB) and commits it with
+ * a single buffered write operation. The flash address must be aligned to the 
+ * write buffer size (128 bytes).
+ * 
+ * @param data is a pointer to FLASH_FWB_WORDS words to be written.
+ * @param addr is the location to write to.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+RAMFUNC int32_t flash_write_block(uint32_t *data, uint32_t addr);
 
 /**
  * @brief Writes data to flash.
  * 
- * This function writes a sequence of words to flash memory. Because the flash 
- * is written one word at a time, the starting address must be a multiple of 4.
+ * This function writes a sequence of words to flash memory. Whole 32-word 
+ * blocks are programmed through the flash write buffer, and any words before
+ * the first or after the last 128-byte boundary are written one at a time. The
+ * starting address must be a multiple of 4.
  * 
  * @param data is a pointer to the data to be written.
  * @param addr is the starting address in flash to be written to.
  * @param count is the number of words to be written.
  * @return 0 on success, or -1 if an error occurs.
  */
-int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count);
+RAMFUNC int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count);
 
 #endif // FLASH_H
\ No newline at end of file
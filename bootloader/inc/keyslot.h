@@ -0,0 +1,30 @@
+/**
+ * @file keyslot.h
+ * @brief Placement of key material in SRAM.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef KEYSLOT_H
+#define KEYSLOT_H
+
+#include <stdint.h>
+
+/*
+ * Variables marked KEYSLOT hold key material derived at run time, such as
+ * expanded round keys. They are linked together at the start of .bss, between
+ * _keyslot and _ekeyslot (see bootloader.ld), so that the whole slot can be
+ * wiped at once when a session ends. The section name keeps them zero
+ * initialised like the rest of .bss.
+ */
+#define KEYSLOT __attribute__((section(".bss.keyslot")))
+
+extern uint32_t _keyslot;
+extern uint32_t _ekeyslot;
+
+#endif // KEYSLOT_H
@@ -0,0 +1,94 @@
+/**
+ * @file lz.h
+ * @brief Bootloader LZ decompression interface.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Compressed images use the LZ4 block format. The stream is a sequence of
+ * literal runs, each followed by a match:
+ *
+ *      token           literal count (high nibble), match length - 4 (low
+ *                      nibble); a nibble of 15 is extended by the following
+ *                      bytes, added until a byte other than 255
+ *      literals        copied to the output as is
+ *      offset          2B little endian, how far back the match starts
+ *
+ * The last sequence has no match; the stream ends once the whole image has
+ * been produced. See lz_compress() in host_tools/util.py.
+ *
+ * The output is produced one page at a time. Matches reaching back before
+ * the current page read the earlier output where it was flushed to (flash),
+ * so the decoder needs no window in SRAM beyond the page buffer.
+ */
+#define LZ_MIN_MATCH 4
+
+/**
+ * @brief Store a full page of output.
+ *
+ * @param addr is where the page belongs, dst + its offset in the image.
+ * @param page is a pointer to the page.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+typedef int32_t (*lz_flush_t)(uint32_t addr, uint8_t *page);
+
+// Function Prototypes
+
+/**
+ * @brief Start decompressing an image.
+ *
+ * @param dst is the address the image is stored at. Matches read the pages
+ * flushed so far from here.
+ * @param page is a pointer to the buffer that receives the current page.
+ * @param page_size is the size of the page buffer.
+ * @param size is the size of the decompressed image.
+ * @param flush is called with each full page, and with the last page padded
+ * with 0xFF. It may be NULL when page is dst and page_size is at least size.
+ */
+void lz_begin(uint32_t dst, uint8_t *page, uint32_t page_size, uint32_t size, lz_flush_t flush);
+
+/**
+ * @brief Decompress the next part of the stream.
+ *
+ * Sequences may be split at any byte between calls.
+ *
+ * @param data is a pointer to the compressed bytes.
+ * @param len is the number of compressed bytes.
+ * @return 0 on success, or -1 if the stream is malformed or a flush failed.
+ */
+int32_t lz_feed(const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Finish decompressing, flushing the last page.
+ *
+ * @return 0 on success, or -1 if the stream was incomplete or a flush failed.
+ */
+int32_t lz_finish(void);
+
+/**
+ * @brief Decompress a whole image that is already in memory.
+ *
+ * A faster equivalent of lz_begin(), lz_feed() and lz_finish() for when the
+ * whole stream is readable and the whole image fits in the destination.
+ *
+ * @param src is a pointer to the compressed image.
+ * @param src_len is the size of the compressed image.
+ * @param dst is a pointer to the buffer that receives the image.
+ * @param size is the size of the decompressed image.
+ * @return 0 on success, or -1 if the stream is malformed.
+ */
+int32_t lz_inflate(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t size);
+
+#endif // LZ_H
@@ -0,0 +1,79 @@
+/**
+ * @file metadata.h
+ * @brief Bootloader metadata store interface, in EEPROM words.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef METADATA_H
+#define METADATA_H
+
+#include <stdint.h>
+
+/*
+ * The TM4C123 EEPROM (2KB) is written a word at a time, without erasing, and
+ * a word that is being written when power is lost keeps either its old or its
+ * new value. It holds the small, often rewritten metadata (sizes, versions,
+ * flags and counters), so flash only holds bulk data. Addresses are byte
+ * offsets into the EEPROM and must be multiples of 4. The first block holds
+ * the EEPROM data provisioned with the device, so the metadata starts at
+ * METADATA_START.
+ */
+#define METADATA_START 0x400
+#define METADATA_END   0x800
+
+// Function Prototypes
+
+/**
+ * @brief Power up the EEPROM and recover from an interrupted write.
+ *
+ * @return 0 on success, or -1 if the EEPROM cannot be used.
+ */
+int32_t metadata_init(void);
+
+/**
+ * @brief Read a metadata word.
+ *
+ * @param addr is the EEPROM address of the word.
+ * @return the word, 0xFFFFFFFF if it was never written.
+ */
+uint32_t metadata_read(uint32_t addr);
+
+/**
+ * @brief Read consecutive metadata words.
+ *
+ * @param data is a pointer to the destination.
+ * @param addr is the EEPROM address of the first word.
+ * @param count is the number of words.
+ */
+void metadata_read_words(uint32_t *data, uint32_t addr, uint32_t count);
+
+/**
+ * @brief Write a metadata word.
+ *
+ * A word that already holds the value is not written again.
+ *
+ * @param data is the value to write.
+ * @param addr is the EEPROM address of the word.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int32_t metadata_write(uint32_t data, uint32_t addr);
+
+/**
+ * @brief Write consecutive metadata words.
+ *
+ * Each word is written on its own, so only the words that change are written.
+ *
+ * @param data is a pointer to the values to write.
+ * @param addr is the EEPROM address of the first word.
+ * @param count is the number of words.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int32_t metadata_write_words(const uint32_t *data, uint32_t addr, uint32_t count);
+
+#endif // METADATA_H
@@ -0,0 +1,73 @@
+/**
+ * @file patch.h
+ * @brief Bootloader firmware patch interface.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef PATCH_H
+#define PATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * A patch rebuilds a new image from the installed (old) image. It is a
+ * sequence of instructions, each an opcode byte followed by an unsigned LEB128
+ * argument:
+ *
+ *      PATCH_COPY n    copy the next n bytes of the old image
+ *      PATCH_ADD n     followed by n bytes, each added (mod 256) to the next
+ *                      byte of the old image
+ *      PATCH_INSERT n  followed by n bytes, copied to the new image as is
+ *      PATCH_SEEK n    move the position in the old image by n (zigzag
+ *                      encoded, so it may be negative)
+ *
+ * Code that moved by a few bytes between versions becomes long copies with
+ * short adds where branch and literal offsets changed. The patch ends once the
+ * whole new image has been produced. See host_tools/fw_patch.
+ */
+#define PATCH_COPY   0x00
+#define PATCH_ADD    0x01
+#define PATCH_INSERT 0x02
+#define PATCH_SEEK   0x03
+
+// Function Prototypes
+
+/**
+ * @brief Start applying a patch.
+ *
+ * @param old is a pointer to the installed image.
+ * @param old_size is the size of the installed image.
+ * @param out is a pointer to the buffer that receives the new image. It must
+ * hold new_size bytes rounded up to a whole flash page.
+ * @param new_size is the size of the new image.
+ */
+void patch_begin(const uint8_t *old, uint32_t old_size, uint8_t *out, uint32_t new_size);
+
+/**
+ * @brief Apply the next part of the patch stream.
+ *
+ * Instructions may be split at any byte between calls.
+ *
+ * @param data is a pointer to the patch bytes.
+ * @param len is the number of patch bytes.
+ * @return 0 on success, or -1 if the patch is malformed.
+ */
+int32_t patch_feed(const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Finish applying a patch.
+ *
+ * Pads the new image with 0xFF up to a whole flash page.
+ *
+ * @return a pointer to the new image, or NULL if the patch was incomplete.
+ */
+uint8_t *patch_finish(void);
+
+#endif // PATCH_H
@@ -0,0 +1,33 @@
+/**
+ * @file ramfunc.h
+ * @brief Placement of code in SRAM.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef RAMFUNC_H
+#define RAMFUNC_H
+
+/*
+ * Functions marked RAMFUNC are linked into the .ramfunc section, which
+ * Bootloader_Startup copies from flash to SRAM before main() is called (see
+ * bootloader.ld). Instruction fetches from flash are held off while the flash
+ * is being erased or programmed, so code that has to keep running during a
+ * flash operation must live in SRAM.
+ *
+ * SRAM is far outside the range of a Thumb BL from flash, so calls into and
+ * out of these functions are made as long calls. The attribute must appear on
+ * the prototype as well as the definition.
+ */
+#ifdef RAMFUNCS
+#define RAMFUNC __attribute__((section(".ramfunc"), long_call, noinline))
+#else
+#define RAMFUNC
+#endif
+
+#endif // RAMFUNC_H
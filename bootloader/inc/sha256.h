@@ -0,0 +1,64 @@
+/**
+ * @file sha256.h
+ * @brief Bootloader SHA-256 interface, with an assembly compression function.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bearssl_hash.h"
+
+/*
+ * A drop-in replacement for BearSSL's br_sha256_*() on the same
+ * br_sha256_context, with the compression function written for the Cortex-M4
+ * (sha256_block.S) instead of the portable C of sha2small.c. Contexts are set
+ * up with br_sha256_init() or sha256_vtable. Selected with CRYPTO_SHA256=ASM,
+ * see crypto_select.h.
+ */
+
+// Function Prototypes
+
+/**
+ * @brief Compress whole 64B blocks into a SHA-256 state.
+ *
+ * @param state is the state, as eight words.
+ * @param data is a pointer to the blocks. It need not be word aligned.
+ * @param blocks is the number of blocks.
+ */
+void sha256_block(uint32_t state[8], const uint8_t *data, uint32_t blocks);
+
+/**
+ * @brief Add data to a SHA-256 computation, as br_sha256_update().
+ *
+ * @param ctx is the context.
+ * @param data is a pointer to the data.
+ * @param len is the number of bytes.
+ */
+void sha256_update(br_sha256_context *ctx, const void *data, size_t len);
+
+/**
+ * @brief Get the hash of the data added so far, as br_sha256_out().
+ *
+ * The context is left unchanged, so more data may be added afterwards.
+ *
+ * @param ctx is the context.
+ * @param out is a pointer to the 32B buffer that receives the hash.
+ */
+void sha256_out(const br_sha256_context *ctx, void *out);
+
+/**
+ * @brief Hash class of this implementation, for generic BearSSL users.
+ */
+extern const br_hash_class sha256_vtable;
+
+#endif // SHA256_H
@@ -21,6 +21,27 @@
 
 #define HOST_UART ((uint32_t)UART0_BASE)
 
+// Host interface rate after reset and after every negotiated session
+#define UART_DEFAULT_BAUD ((uint32_t)115200)
+
+// Size of the host receive ring buffer (must be a power of 2)
+#ifndef UART_RX_BUF_SIZE
+#define UART_RX_BUF_SIZE 1024
+#endif
+
+// Maximum number of outstanding background receives (uart_rx_submit)
+#ifndef UART_RX_QUEUE_LEN
+#define UART_RX_QUEUE_LEN 4
+#endif
+
+/**
+ * @brief Receive error counters for a UART interface.
+ */
+typedef struct {
+    uint32_t hw_overruns;  // hardware FIFO overflowed before it was drained
+    uint32_t sw_overruns;  // bytes dropped because the ring buffer was full
+} uart_rx_stats_t;
+
 /**
  * @brief Initialize the UART interfaces.
  * 
@@ -30,6 +51,94 @@
 void uart_init(void);
 
 
+/**
+ * @brief Stop interrupt-driven reception on the host interface.
+ * 
+ * Must be called before handing control to the firmware so that it gets the
+ * UART back in a polled state at the default rate. Interrupts are left
+ * disabled, the uDMA controller is turned off and the vector table is moved
+ * back to flash.
+ */
+void uart_deinit(void);
+
+
+/**
+ * @brief Change the baud rate of a UART interface.
+ * 
+ * Waits for the transmitter to finish sending at the old rate, then programs
+ * the divisors for the new rate from the current system clock (8-N-1).
+ * 
+ * @param uart is the base address of the UART port.
+ * @param baud is the new baud rate.
+ */
+void uart_set_baudrate(uint32_t uart, uint32_t baud);
+
+
+/**
+ * @brief Get the highest baud rate a UART interface can run at.
+ * 
+ * @return the maximum baud rate for the current system clock.
+ */
+uint32_t uart_max_baudrate(void);
+
+
+/**
+ * @brief Read the receive error counters of a UART interface.
+ * 
+ * @param uart is the base address of the UART port.
+ * @param stats is a pointer to the structure to fill in.
+ */
+void uart_rx_stats(uint32_t uart, uart_rx_stats_t *stats);
+
+
+/**
+ * @brief Prepare a UART interface for a sequence of background receives.
+ * 
+ * When uDMA support is built in (UART_DMA), the receive FIFO is handed to the
+ * uDMA ping-pong channel until uart_rx_end() is called. Bytes that already
+ * arrived in the ring buffer are delivered to the first requests.
+ * 
+ * @param uart is the base address of the UART port.
+ */
+void uart_rx_begin(uint32_t uart);
+
+
+/**
+ * @brief Queue a buffer to be filled in the background.
+ * 
+ * Requests are filled in the order they are submitted. At most
+ * UART_RX_QUEUE_LEN requests can be outstanding, and a handle stays valid
+ * until that many further requests have been submitted.
+ * 
+ * @param uart is the base address of the UART port.
+ * @param buf is a pointer to the destination for the received data.
+ * @param len is the number of bytes to receive.
+ * @return a handle for uart_rx_done(), or -1 if the queue is full.
+ */
+int32_t uart_rx_submit(uint32_t uart, uint8_t *buf, uint32_t len);
+
+
+/**
+ * @brief Check if a background receive has completed.
+ * 
+ * @param uart is the base address of the UART port.
+ * @param handle is the value returned by uart_rx_submit().
+ * @return true if the buffer has been filled.
+ */
+bool uart_rx_done(uint32_t uart, int32_t handle);
+
+
+/**
+ * @brief Finish a sequence of background receives.
+ * 
+ * Outstanding requests are cancelled and reception goes back to the ring
+ * buffer.
+ * 
+ * @param uart is the base address of the UART port.
+ */
+void uart_rx_end(uint32_t uart);
+
+
 /**
  * @brief Check if there are characters available on a UART interface.
  * 
@@ -49,6 +158,37 @@ bool uart_avail(uint32_t uart);
 int32_t uart_readb(uint32_t uart);
 
 
+/**
+ * @brief Wait for a byte on a UART interface without reading it.
+ * 
+ * @param uart is the base address of the UART port to wait on.
+ * @param timeout_ms is the number of milliseconds to wait for a byte.
+ * @return true if a byte is available, or false on timeout.
+ */
+bool uart_wait(uint32_t uart, uint32_t timeout_ms);
+
+
+/**
+ * @brief Discard received bytes until a UART interface has been idle for a
+ * while.
+ * 
+ * @param uart is the base address of the UART port to drain.
+ * @param idle_ms is the number of milliseconds without a byte that ends the
+ * drain.
+ */
+void uart_drain(uint32_t uart, uint32_t idle_ms);
+
+
+/**
+ * @brief Read a byte from a UART interface, giving up after a timeout.
+ * 
+ * @param uart is the base address of the UART port to read from.
+ * @param timeout_ms is the number of milliseconds to wait for a byte.
+ * @return the character read from the interface, or -1 on timeout.
+ */
+int32_t uart_readb_timeout(uint32_t uart, uint32_t timeout_ms);
+
+
 /**
  * @brief Read a sequence of bytes from a UART interface.
  * 
@@ -69,13 +69,17 @@ static volatile uint32_t pui32Stack[64];
 //*****************************************************************************
 //
 // The following are constructs created by the linker, indicating where the
-// the "data" and "bss" segments reside in memory.  The initializers for the
-// for the "data" segment resides immediately following the "text" segment.
+// the "data", "ramfunc" and "bss" segments reside in memory.  The initializers
+// for the "data" segment resides immediately following the "text" segment, and
+// the "ramfunc" code immediately following those.
 //
 //*****************************************************************************
 extern uint32_t _ldata;
 extern uint32_t _data;
 extern uint32_t _edata;
+extern uint32_t _lramfunc;
+extern uint32_t _ramfunc;
+extern uint32_t _eramfunc;
 extern uint32_t _bss;
 extern uint32_t _ebss;
 
@@ -106,6 +110,15 @@ void Bootloader_Startup(void)
         *pui32Dest++ = *pui32Src++;
     }
 
+    //
+    // Copy the RAM-resident functions from flash to SRAM.
+    //
+    pui32Src = &_lramfunc;
+    for(pui32Dest = &_ramfunc; pui32Dest < &_eramfunc; )
+    {
+        *pui32Dest++ = *pui32Src++;
+    }
+
     //
     // Zero fill the bss segment. Set the actual application stack pointer
     //
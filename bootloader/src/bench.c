@@ -0,0 +1,162 @@
+/**
+ * @file bench.c
+ * @brief Bootloader cycle measurement implementation.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "inc/hw_nvic.h"
+#include "inc/hw_types.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/systick.h"
+
+#include "bench.h"
+#include "uart.h"
+
+// SysTick is a 24-bit down counter
+#define BENCH_PERIOD 0x01000000
+
+typedef struct {
+    uint32_t count;
+    uint64_t total;
+    uint32_t max;
+} bench_stat_t;
+
+static const char *const bench_names[BENCH_SLOTS] = {
+    "load",
+    "rx_wait",
+    "flash_erase",
+    "flash_write",
+    "page_compare",
+    "boot_load",
+    "decrypt",
+    "digest",
+    "key_schedule",
+    "boot_verify",
+    "erase_ahead",
+};
+
+static bench_stat_t bench_stats[BENCH_SLOTS];
+
+// Number of SysTick wraps since bench_init()
+static volatile uint32_t bench_wraps = 0;
+
+
+/**
+ * @brief SysTick interrupt handler, extends the counter to 32 bits.
+ */
+static void bench_systick_isr(void)
+{
+    bench_wraps++;
+}
+
+
+/**
+ * @brief Start the cycle counter.
+ */
+void bench_init(void)
+{
+    SysTickPeriodSet(BENCH_PERIOD);
+    SysTickIntRegister(bench_systick_isr);
+    SysTickIntEnable();
+    SysTickEnable();
+}
+
+
+/**
+ * @brief Stop the cycle counter and release the SysTick interrupt.
+ */
+void bench_deinit(void)
+{
+    SysTickIntDisable();
+    SysTickDisable();
+    SysTickIntUnregister();
+}
+
+
+/**
+ * @brief Read the cycle counter.
+ *
+ * @return the number of system clock cycles since bench_init().
+ */
+uint32_t bench_now(void)
+{
+    uint32_t wraps;
+    uint32_t ticks;
+
+    // Retry if the counter wrapped between the two reads
+    do {
+        wraps = bench_wraps;
+        ticks = HWREG(NVIC_ST_CURRENT);
+    } while (wraps != bench_wraps);
+
+    return (wraps << 24) + ((BENCH_PERIOD - 1) - ticks);
+}
+
+
+/**
+ * @brief Add a measurement to a slot.
+ *
+ * @param slot is the measured region.
+ * @param start is the bench_now() value at the start of the region.
+ */
+void bench_record(bench_slot_t slot, uint32_t start)
+{
+    uint32_t cycles = bench_now() - start;
+
+    bench_stats[slot].count++;
+    bench_stats[slot].total += cycles;
+    if (cycles > bench_stats[slot].max) {
+        bench_stats[slot].max = cycles;
+    }
+}
+
+
+/**
+ * @brief Write a little-endian integer to a UART interface.
+ */
+static void bench_write_le(uint32_t uart, uint64_t value, uint32_t bytes)
+{
+    while (bytes--) {
+        uart_writeb(uart, (uint8_t)value);
+        value >>= 8;
+    }
+}
+
+
+/**
+ * @brief Send all measurements to the host and clear them.
+ *
+ * @param uart is the base address of the UART interface to write to.
+ */
+void bench_report(uint32_t uart)
+{
+    int i;
+    const char *name;
+
+    bench_write_le(uart, SysCtlClockGet(), 4);
+    uart_writeb(uart, BENCH_SLOTS);
+
+    for (i = 0; i < BENCH_SLOTS; i++) {
+        for (name = bench_names[i]; *name; name++) {
+            uart_writeb(uart, *name);
+        }
+        uart_writeb(uart, '\0');
+
+        bench_write_le(uart, bench_stats[i].count, 4);
+        bench_write_le(uart, bench_stats[i].total, 8);
+        bench_write_le(uart, bench_stats[i].max, 4);
+
+        bench_stats[i].count = 0;
+        bench_stats[i].total = 0;
+        bench_stats[i].max = 0;
+    }
+}
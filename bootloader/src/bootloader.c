@@ -13,10 +13,22 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
+#include "inc/hw_nvic.h"
+#include "inc/hw_types.h"
 #include "driverlib/interrupt.h"
+#include "driverlib/sw_crc.h"
+#include "driverlib/sysctl.h"
 
+#include "bench.h"
+#include "copy.h"
 #include "flash.h"
+#include "keyslot.h"
+#include "lz.h"
+#include "metadata.h"
+#include "patch.h"
+#include "ramfunc.h"
 #include "uart.h"
 
 // this will run if EXAMPLE_AES is defined in the Makefile (see line 54)
@@ -26,37 +38,66 @@
 #include "bearssl_rsa.h"
 #include "bearssl_block.h"
 #include "inner.h"
+#include "crypto_select.h"
+#endif
+#ifdef CRYPTO_BENCH
+#include "crypto_bench.h"
 #endif
 
 
 // Storage layout
 
 /*
- * Firmware:
- *      Hash:    0x0002B3B0 : 0x0002B400 (50B = 32B + pad)
- *      Size:    0x0002B400 : 0x0002B404 (4B)
- *      Version: 0x0002B404 : 0x0002B408 (4B)
- *      Msg:     0x0002B408 : 0x0002BC00 (~2KB = 1KB + 1B + pad)
- *      Fw:      0x0002BC00 : 0x0002FC00 (16KB)
+ * Firmware, in two slots with the same layout:
+ *      Slot A:  0x0002B400 : 0x0002FC00
+ *      Slot B:  0x00026800 : 0x0002B000
+ *      Msg:     +0x0000 : +0x0800 (2KB = 1KB + 1B + pad)
+ *      Fw:      +0x0800 : +0x4800 (16KB)
  * Configuration:
- *      Size:    0x0002FC00 : 0x0003000 (1KB = 4B + pad)
  *      Cfg:     0x00030000 : 0x0004000 (64KB)
  */
 #define FIRMWARE_AES_PTR           ((uint32_t)(FLASH_START + 0x0002B370))
-#define FIRMWARE_HASH_PTR          ((unsigned char *)(FLASH_START + 0x0002B3B0))
-#define FIRMWARE_METADATA_PTR      ((uint32_t)(FLASH_START + 0x0002B400))
-#define FIRMWARE_SIZE_PTR          ((uint32_t)(FIRMWARE_METADATA_PTR + 0))
-#define FIRMWARE_VERSION_PTR       ((uint32_t)(FIRMWARE_METADATA_PTR + 4))
-#define FIRMWARE_RELEASE_MSG_PTR   ((uint32_t)(FIRMWARE_METADATA_PTR + 8))
-#define FIRMWARE_RELEASE_MSG_PTR2  ((uint32_t)(FIRMWARE_METADATA_PTR + FLASH_PAGE_SIZE))
-#define FIRMWARE_DATA_PTR          ((unsigned char)(FIRMWARE_METADATA_PTR + (FLASH_PAGE_SIZE*2)))
-#define FIRMWARE_STORAGE_PTR       ((uint32_t)(FIRMWARE_METADATA_PTR + (FLASH_PAGE_SIZE*2)))
+#define SLOT_A_PTR                 ((uint32_t)(FLASH_START + 0x0002B400))
+#define SLOT_B_PTR                 ((uint32_t)(FLASH_START + 0x00026800))
+#define FIRMWARE_METADATA_PTR(s)   ((uint32_t)(((s) == SLOT_B) ? SLOT_B_PTR : SLOT_A_PTR))
+#define FIRMWARE_RELEASE_MSG_PTR(s)  ((uint32_t)(FIRMWARE_METADATA_PTR(s) + 0))
+#define FIRMWARE_RELEASE_MSG_PAGES 2
+#define FIRMWARE_STORAGE_PTR(s)    ((uint32_t)(FIRMWARE_METADATA_PTR(s) + (FLASH_PAGE_SIZE*2)))
 #define FIRMWARE_BOOT_PTR          ((uint32_t)0x20004000)
+#define FIRMWARE_BOOT_SIZE         0x4000
+#define SRAM_START                 ((uint32_t)0x20000000)
+#define SRAM_END                   ((uint32_t)(FIRMWARE_BOOT_PTR + FIRMWARE_BOOT_SIZE))
+
+#define CONFIGURATION_STORAGE_PTR  ((uint32_t)(FIRMWARE_STORAGE_PTR(SLOT_A) + (FLASH_PAGE_SIZE*17)))
 
-#define CONFIGURATION_METADATA_PTR ((uint32_t)(FIRMWARE_STORAGE_PTR + (FLASH_PAGE_SIZE*16)))
-#define CONFIGURATION_SIZE_PTR     ((uint32_t)(CONFIGURATION_METADATA_PTR + 0))
+#define FIRMWARE_STORAGE_PAGES      16
+#define CONFIGURATION_STORAGE_PAGES ((FLASH_END - CONFIGURATION_STORAGE_PTR) / FLASH_PAGE_SIZE)
 
-#define CONFIGURATION_STORAGE_PTR  ((uint32_t)(CONFIGURATION_METADATA_PTR + FLASH_PAGE_SIZE))
+/*
+ * Metadata, in EEPROM words (see metadata.h):
+ *      Slot A:  0x0400 : 0x0440
+ *      Slot B:  0x0440 : 0x0480
+ *      Size:    +0x00 (4B)
+ *      Version: +0x04 (4B)
+ *      Status:  +0x08 : +0x10 (8B = flag + metadata CRC-32)
+ *      Scrub:   +0x10 (4B = boots since the image was hashed)
+ *      Hash:    +0x14 : +0x34 (32B)
+ * Active slot:  0x0480 (4B)
+ * Configuration size: 0x0484 (4B)
+ * Transfer journal: 0x04C0 : 0x04F4 (48B header + 4B committed pages)
+ */
+#define META_SLOT(s)               ((uint32_t)(METADATA_START + (s) * 0x40))
+#define META_SIZE(s)               (META_SLOT(s) + 0x00)
+#define META_VERSION(s)            (META_SLOT(s) + 0x04)
+#define META_STATUS(s)             (META_SLOT(s) + 0x08)
+#define META_STATUS_CRC(s)         (META_SLOT(s) + 0x0C)
+#define META_SCRUB(s)              (META_SLOT(s) + 0x10)
+#define META_HASH(s)               (META_SLOT(s) + 0x14)
+#define META_ACTIVE_SLOT           ((uint32_t)(METADATA_START + 0x80))
+#define META_CONFIG_SIZE           ((uint32_t)(METADATA_START + 0x84))
+#define META_JOURNAL               ((uint32_t)(METADATA_START + 0xC0))
+#define META_JOURNAL_SESSION       (META_JOURNAL + 4)
+#define META_JOURNAL_PAGES         (META_JOURNAL + JOURNAL_HEADER_WORDS * 4)
 
 
 
@@ -64,46 +105,273 @@
 // Firmware update constants
 #define FRAME_OK 0x00
 #define FRAME_BAD 0x01
+#define FRAME_ABORT 0x02
+#define FRAME_SKIPPED 0x03  // windowed ack: page already held this data
+
+// Windowed transfer constants
+#define FRAME_HEADER_SIZE 8         // sequence (2B), length (2B), payload CRC-32 (4B)
+#define FRAME_ADDR_SIZE   4         // page index (2B), reserved (2B) of an addressed frame
+#define FRAME_HEADER_MAX  (FRAME_ADDR_SIZE + FRAME_HEADER_SIZE)
+#define FRAME_TAG_SIZE    16        // Poly1305 tag following the payload of a sealed frame
+#define LOAD_BUFFERS      2         // frames received ahead of programming
+#define LOAD_WINDOW_MAX   LOAD_BUFFERS
+#define LOAD_MAX_RETRIES  8         // NAKs of one frame before the transfer is aborted
+#define LOAD_DRAIN_MS     50        // idle line that ends the frames in flight after a NAK or abort
+#define LOAD_TIMEOUT_MS   3000      // wait for a frame before the host is taken to be gone
+
+// Window granted by the last 'W' command, 0 for stop-and-wait transfers
+static uint8_t load_window = 0;
+
+// Transfer types of load_data()
+#define LOAD_PAGES 0    // the image, page by page
+#define LOAD_DELTA 1    // addressed pages that differ from flash ('D')
+#define LOAD_PATCH 2    // a patch against the installed firmware ('X')
+#define LOAD_LZ    3    // the image, compressed (SIZE_COMPRESSED)
+#define LOAD_SECURE 0x80    // flag: AES-CBC encrypted frames of a SHA-256 checked image
+#define LOAD_AEAD   0x40    // flag with LOAD_SECURE: ChaCha20-Poly1305 sealed frames instead
+
+// Flag in the size of an update or configure: the image follows compressed
+#define SIZE_COMPRESSED 0x80000000
+
+// Flag in the size of an update, kept in the firmware metadata: the firmware
+// is stored packed, as its unpacked size (4B) and an LZ4 block, and inflated
+// into the boot RAM by handle_boot()
+#define SIZE_PACKED     0x40000000
+
+// Flag in the size of an update: the frames are sealed with ChaCha20-Poly1305
+// rather than forming one AES-CBC stream
+#define SIZE_AEAD       0x20000000
+
+// Flag in the size of an update, kept in the firmware metadata: the firmware
+// is linked for FIRMWARE_STORAGE_PTR and starts from its own vector table
+// there, without being copied into the boot RAM
+#define SIZE_XIP        0x10000000
+
+// Verification status of the installed firmware, written once its digest has
+// been checked; cleared (0xFFFFFFFF) while an update is in progress. It is
+// followed by a CRC-32 of the size, version and hash it was written for.
+#define FIRMWARE_VERIFIED 0x56455249    // "VERI"
+
+// Firmware slots. Updates go to the slot that is not active, which becomes
+// active once the update is verified.
+#define SLOT_A 0
+#define SLOT_B 1
+#define SLOT_OTHER(s)      ((s) ^ 1)
+#define SLOT_SELECT_A      0x534C5441   // "SLTA"
+#define SLOT_SELECT_B      0x534C5442   // "SLTB"
+
+// Boots that trust the verification status before the image is hashed again.
+// Each one is counted by the scrub counter.
+#define FIRMWARE_SCRUB_BOOTS 64
+
+// Transfer type requested by the last 'D' or 'X' command
+static uint8_t load_mode = LOAD_PAGES;
+
+// Called by load_data() once the last frame is in flash and checked, before
+// it is acknowledged; a failure is answered like a bad frame
+static int32_t (*load_finish)(void) = NULL;
+
+// The EEPROM holding the metadata came up (see metadata_init()). Without it
+// nothing is installed, rolled back or booted.
+static bool metadata_ready = false;
+
+// Transfer journal: names the update or configure in progress, as its magic,
+// session (chosen by the host), first page, header size field and SHA-256
+// (0xFF for a configure), and counts the pages committed to flash, so that
+// the transfer can be resumed after the link drops. Only full transfers of
+// plain or sealed frames are journaled.
+#define JOURNAL_MAGIC        0x4A524E4C     // "JRNL"
+#define JOURNAL_HEADER_WORDS 12
+
+// Session named by the last 'J' command, resumed by the next update or
+// configure if it is the one in the journal
+static bool load_resumable = false;
+static uint32_t load_session = 0;
+
+// The journal records the transfer in progress
+static bool journal_active = false;
+
+// Baud rate negotiation constants
+#define BAUD_SYNC_TIMEOUT_MS 1000  // wait for the host sync pattern at the new rate
+#define BAUD_DIGITS_MAX      10
+
+static const uint8_t baud_sync[4] = {0x55, 0xAA, 0x0F, 0xF0};
+#define BAUD_CONFIRM 0xC3   // host saw the echoed sync pattern
+
+// Host interface rate set by the last 'S' command
+static uint32_t host_baud = UART_DEFAULT_BAUD;
+
+// Firmware update cryptography
+#define AES_BLOCK_SIZE 16
+#define SHA256_SIZE    32
+#define AEAD_NONCE_SIZE 12  // IV prefix (8B) and frame index (4B)
+#define AEAD_AAD_SIZE   6   // version (2B) and size (4B) as sent in the update header
 
 static unsigned char aes_key[16] = {
     0x1a, 0x2a, 0x3a, 0x4a, 0x5a, 0x6a, 0x7a, 0x8a,
     0x1a, 0x2a, 0x3a, 0x4a, 0x5a, 0x6a, 0x7a, 0x8a
 };
 
+static const unsigned char chacha_key[32] = {
+    0x1b, 0x2b, 0x3b, 0x4b, 0x5b, 0x6b, 0x7b, 0x8b,
+    0x1b, 0x2b, 0x3b, 0x4b, 0x5b, 0x6b, 0x7b, 0x8b,
+    0x1b, 0x2b, 0x3b, 0x4b, 0x5b, 0x6b, 0x7b, 0x8b,
+    0x1b, 0x2b, 0x3b, 0x4b, 0x5b, 0x6b, 0x7b, 0x8b
+};
+
 
 /**
- * @brief Boot the firmware.
+ * @brief Select the system clock for the bootloader.
+ * 
+ * With SYSCLK_PLL set in the Makefile the core is brought up to 80 MHz from
+ * the PLL (400 MHz / 2 / 2.5) driven by the 16 MHz main crystal. Otherwise
+ * the reset-default 16 MHz internal oscillator is kept.
  */
-void handle_boot(void)
+static void clock_init(void)
 {
-    uint32_t size;
-    uint32_t i = 0;
-    uint8_t *rel_msg;
+#ifdef SYSCLK_PLL
+    SysCtlClockSet(SYSCTL_SYSDIV_2_5 | SYSCTL_USE_PLL | SYSCTL_XTAL_16MHZ |
+                   SYSCTL_OSC_MAIN);
+#endif
+}
 
-    // Acknowledge the host
-    uart_writeb(HOST_UART, 'B');
 
-    // Find the metadata
-    size = *((uint32_t *)FIRMWARE_SIZE_PTR);
+/**
+ * @brief Return the system clock to its reset configuration.
+ * 
+ * The firmware is started on the same 16 MHz internal oscillator it would see
+ * coming out of reset.
+ */
+static void clock_deinit(void)
+{
+#ifdef SYSCLK_PLL
+    SysCtlClockSet(SYSCTL_SYSDIV_1 | SYSCTL_USE_OSC | SYSCTL_XTAL_16MHZ |
+                   SYSCTL_OSC_INT);
+#endif
+}
 
-    // Copy the firmware into the Boot RAM section
-    for (i = 0; i < size; i++) {
-        *((uint8_t *)(FIRMWARE_BOOT_PTR + i)) = *((uint8_t *)(FIRMWARE_STORAGE_PTR + i));
+
+/**
+ * @brief Check the vector table of an image that is executed in place.
+ * 
+ * @param vectors is the address of the image, which starts with its vector
+ * table.
+ * @param size is the size of the image.
+ * @return 0 if the initial stack pointer is in SRAM and the reset handler is
+ * Thumb code within the image, or -1 otherwise.
+ */
+static int32_t check_vectors(uint32_t vectors, uint32_t size)
+{
+    uint32_t sp;
+    uint32_t reset;
+
+    if ((size < 8) || (size > FIRMWARE_STORAGE_PAGES * FLASH_PAGE_SIZE)) {
+        return -1;
     }
 
-    uart_writeb(HOST_UART, 'M');
+    sp = *((uint32_t *)vectors);
+    reset = *((uint32_t *)(vectors + 4));
+    if ((sp <= SRAM_START) || (sp > SRAM_END) || (sp & 3)) {
+        return -1;
+    }
+    if (!(reset & 1) || ((reset & ~1) < vectors) || ((reset & ~1) >= vectors + size)) {
+        return -1;
+    }
 
-    // Print the release message
-    rel_msg = (uint8_t *)FIRMWARE_RELEASE_MSG_PTR;
-    while (*rel_msg != 0) {
-        uart_writeb(HOST_UART, *rel_msg);
-        rel_msg++;
+    return 0;
+}
+
+
+/**
+ * @brief Start an image from its vector table, as a reset would.
+ * 
+ * @param vectors is the address of the vector table.
+ */
+static void boot_in_place(uint32_t vectors)
+{
+    uint32_t sp = *((uint32_t *)vectors);
+    uint32_t reset = *((uint32_t *)(vectors + 4));
+
+    // Exceptions are taken through the image's own table from here on
+    HWREG(NVIC_VTABLE) = vectors;
+    __asm volatile ("dsb\n"
+                    "isb\n"
+                    "msr msp, %0\n"
+                    "bx %1\n"
+                    : : "r" (sp), "r" (reset) : "memory");
+}
+
+
+/**
+ * @brief Find the active firmware slot.
+ * 
+ * @return the slot named by the active slot word, or SLOT_A if it was never
+ * written.
+ */
+static uint32_t slot_active(void)
+{
+    return (metadata_read(META_ACTIVE_SLOT) == SLOT_SELECT_B) ? SLOT_B : SLOT_A;
+}
+
+
+/**
+ * @brief Make a firmware slot active.
+ * 
+ * The switch is a single EEPROM word, so it either happens or it does not.
+ * 
+ * @param slot is the slot to boot from now on.
+ * @return 0 on success, or -1 if the word could not be written.
+ */
+static int32_t slot_select(uint32_t slot)
+{
+    return metadata_write((slot == SLOT_B) ? SLOT_SELECT_B : SLOT_SELECT_A, META_ACTIVE_SLOT);
+}
+
+
+/**
+ * @brief Copy the firmware into the boot RAM, inflating a packed image.
+ * 
+ * An image executed in place (SIZE_XIP) is not copied at all.
+ * 
+ * @param slot is the slot holding the firmware.
+ * @return 0 on success, or -1 if the stored image does not fit or is damaged.
+ */
+static int32_t load_firmware(uint32_t slot)
+{
+    uint32_t size;
+    uint32_t unpacked;
+    int32_t error = 0;
+
+    // Find the metadata
+    size = metadata_read(META_SIZE(slot));
+
+    // Executed in place, so only the vector table is checked
+    if (size & SIZE_XIP) {
+        return check_vectors(FIRMWARE_STORAGE_PTR(slot), size & ~SIZE_XIP);
     }
-    uart_writeb(HOST_UART, '\0');
 
-    // Execute the firmware
-    void (*firmware)(void) = (void (*)(void))(FIRMWARE_BOOT_PTR + 1);
-    firmware();
+    BENCH_START(load_start);
+    if (size & SIZE_PACKED) {
+        // Inflate straight into the Boot RAM section
+        size &= ~SIZE_PACKED;
+        unpacked = *((uint32_t *)FIRMWARE_STORAGE_PTR(slot));
+        if ((size < 4) || (size > FIRMWARE_STORAGE_PAGES * FLASH_PAGE_SIZE) ||
+                (unpacked > FIRMWARE_BOOT_SIZE)) {
+            return -1;
+        }
+        error = lz_inflate((uint8_t *)(FIRMWARE_STORAGE_PTR(slot) + 4), size - 4,
+                           (uint8_t *)FIRMWARE_BOOT_PTR, unpacked);
+    } else {
+        // Copy the firmware into the Boot RAM section; a size of 0 marks an
+        // update that did not complete
+        if ((size == 0) || (size > FIRMWARE_BOOT_SIZE)) {
+            return -1;
+        }
+        copy_aligned((uint8_t *)FIRMWARE_BOOT_PTR, (uint8_t *)FIRMWARE_STORAGE_PTR(slot), size);
+    }
+    BENCH_STOP(BENCH_BOOT_LOAD, load_start);
+
+    return error;
 }
 
 
@@ -124,7 +392,7 @@ void handle_readback(void)
 
     if (region == 'F') {
         // Set the base address for the readback
-        address = (uint8_t *)FIRMWARE_STORAGE_PTR;
+        address = (uint8_t *)FIRMWARE_STORAGE_PTR(slot_active());
         // Acknowledge the host
         uart_writeb(HOST_UART, 'F');
     } else if (region == 'C') {
@@ -147,146 +415,1152 @@ void handle_readback(void)
 }
 
 
+// Frame buffers: a frame is received into one while another is programmed.
+// The payload follows the frame header so that pages stay word aligned, and
+// is followed by the tag of a sealed frame.
+static uint32_t frame_buffers[LOAD_BUFFERS][(FRAME_HEADER_MAX + FLASH_PAGE_SIZE + FRAME_TAG_SIZE) >> 2];
+
+
+/**
+ * @brief Send a windowed transfer status to the host.
+ * 
+ * @param status is FRAME_OK (cumulative ack), FRAME_BAD (resend from seq) or
+ * FRAME_ABORT.
+ * @param seq is the frame sequence number the status refers to.
+ */
+static void send_frame_status(uint8_t status, uint32_t seq)
+{
+    uart_writeb(HOST_UART, status);
+    uart_writeb(HOST_UART, (uint8_t)(seq >> 8));
+    uart_writeb(HOST_UART, (uint8_t)seq);
+}
+
+
+// Firmware decryption state: AES-128-CBC, the IV carried from frame to frame.
+// The round keys are expanded once per session and wiped when it ends.
+static struct {
+    crypto_cbcdec_keys keys;
+    uint8_t iv[AES_BLOCK_SIZE];
+    bool ready;
+} cipher KEYSLOT;
+
+// Sealed frame state: the nonce ends with the frame index, and the update
+// header is authenticated with every frame
+static struct {
+    uint8_t nonce[AEAD_NONCE_SIZE];
+    uint8_t aad[AEAD_AAD_SIZE];
+} aead;
+
+// Digest of the image being programmed, checked once the last page is in
+static struct {
+    br_sha256_context ctx;
+    uint32_t dst;
+    uint32_t size;
+    uint32_t pos;
+    bool active;
+    bool error;
+    uint8_t expected[SHA256_SIZE];
+} digest;
+
+
+/**
+ * @brief Expand the AES key, unless it already was this session.
+ */
+static void cipher_open(void)
+{
+    if (!cipher.ready) {
+        BENCH_START(keysched_start);
+        crypto_cbcdec_vtable.init(&cipher.keys.vtable, aes_key, sizeof(aes_key));
+        BENCH_STOP(BENCH_KEY_SCHEDULE, keysched_start);
+        cipher.ready = true;
+    }
+}
+
+
+/**
+ * @brief Start decrypting a CBC stream with the session's round keys.
+ * 
+ * @param iv is a pointer to the IV sent with the update.
+ */
+static void cipher_begin(const uint8_t *iv)
+{
+    cipher_open();
+    memcpy(cipher.iv, iv, sizeof(cipher.iv));
+}
+
+
+/**
+ * @brief Decrypt the next part of a CBC stream in place.
+ * 
+ * @param data is a pointer to the ciphertext.
+ * @param len is the number of bytes, a multiple of AES_BLOCK_SIZE.
+ */
+static void cipher_run(uint8_t *data, uint32_t len)
+{
+    BENCH_START(decrypt_start);
+    crypto_cbcdec_vtable.run(&cipher.keys.vtable, cipher.iv, data, len);
+    BENCH_STOP(BENCH_DECRYPT, decrypt_start);
+}
+
+
+/**
+ * @brief Wipe the key slot, ending the session's use of the round keys.
+ */
+static void cipher_close(void)
+{
+    volatile uint32_t *p;
+
+    // volatile, so the stores cannot be dropped as dead
+    for (p = &_keyslot; p < &_ekeyslot; p++) {
+        *p = 0;
+    }
+}
+
+
+/**
+ * @brief Start opening the sealed frames of a firmware update.
+ * 
+ * @param iv is a pointer to the IV sent with the update; its first 8 bytes
+ * start every frame nonce.
+ * @param version is the version from the update header.
+ * @param size is the size from the update header, with its flags.
+ */
+static void aead_begin(const uint8_t *iv, uint32_t version, uint32_t size)
+{
+    memcpy(aead.nonce, iv, AEAD_NONCE_SIZE - 4);
+
+    aead.aad[0] = (uint8_t)(version >> 8);
+    aead.aad[1] = (uint8_t)version;
+    aead.aad[2] = (uint8_t)(size >> 24);
+    aead.aad[3] = (uint8_t)(size >> 16);
+    aead.aad[4] = (uint8_t)(size >> 8);
+    aead.aad[5] = (uint8_t)size;
+}
+
+
+/**
+ * @brief Authenticate and decrypt a sealed frame in place.
+ * 
+ * The frame index in the nonce ties each frame to its position, so frames
+ * cannot be reordered, replayed from another position or dropped.
+ * 
+ * @param data is a pointer to the ciphertext, followed by its tag.
+ * @param len is the number of ciphertext bytes.
+ * @param index is the page index of the frame.
+ * @return 0 on success, or -1 if the tag does not match.
+ */
+static int32_t aead_open(uint8_t *data, uint32_t len, uint32_t index)
+{
+    uint8_t tag[FRAME_TAG_SIZE];
+    uint8_t diff = 0;
+    uint32_t i;
+
+    aead.nonce[AEAD_NONCE_SIZE - 4] = (uint8_t)(index >> 24);
+    aead.nonce[AEAD_NONCE_SIZE - 3] = (uint8_t)(index >> 16);
+    aead.nonce[AEAD_NONCE_SIZE - 2] = (uint8_t)(index >> 8);
+    aead.nonce[AEAD_NONCE_SIZE - 1] = (uint8_t)index;
+
+    BENCH_START(decrypt_start);
+    crypto_poly1305_run(chacha_key, aead.nonce, data, len, aead.aad, sizeof(aead.aad), tag,
+                        crypto_chacha20_run, 0);
+    BENCH_STOP(BENCH_DECRYPT, decrypt_start);
+
+    for (i = 0; i < FRAME_TAG_SIZE; i++) {
+        diff |= tag[i] ^ data[len + i];
+    }
+
+    return diff ? -1 : 0;
+}
+
+
+/**
+ * @brief Start the digest of an image as it is programmed.
+ * 
+ * @param dst is the address the image is stored at.
+ * @param size is the size of the image.
+ * @param expected is a pointer to the SHA-256 the image must have.
+ */
+static void digest_begin(uint32_t dst, uint32_t size, const uint8_t *expected)
+{
+    br_sha256_init(&digest.ctx);
+    digest.dst = dst;
+    digest.size = size;
+    digest.pos = 0;
+    digest.active = true;
+    digest.error = false;
+    memcpy(digest.expected, expected, sizeof(digest.expected));
+}
+
+
+/**
+ * @brief Hash part of the image, up to its size.
+ * 
+ * @param data is a pointer to the part starting at digest.pos.
+ * @param len is the number of bytes available.
+ */
+static void digest_update(const uint8_t *data, uint32_t len)
+{
+    if (len > digest.size - digest.pos) {
+        len = digest.size - digest.pos;
+    }
+
+    BENCH_START(digest_start);
+    crypto_sha256_update(&digest.ctx, data, len);
+    BENCH_STOP(BENCH_DIGEST, digest_start);
+    digest.pos += len;
+}
+
+
+/**
+ * @brief Add a page to the digest as it is programmed.
+ * 
+ * Pages are hashed from the buffer they are programmed from, so the image is
+ * never read back. Pages skipped by a delta transfer are hashed from flash,
+ * where they were left unchanged.
+ * 
+ * @param addr is the page address in flash.
+ * @param page is a pointer to the page.
+ */
+static void digest_page(uint32_t addr, const uint8_t *page)
+{
+    uint32_t offset = addr - digest.dst;
+
+    if (!digest.active || (offset >= digest.size)) {
+        return;
+    }
+
+    // pages have to arrive in order
+    if (offset < digest.pos) {
+        digest.error = true;
+        return;
+    }
+    digest_update((const uint8_t *)(digest.dst + digest.pos), offset - digest.pos);
+    digest_update(page, FLASH_PAGE_SIZE);
+}
+
+
+/**
+ * @brief Finish the digest and check it.
+ * 
+ * @return 0 if the image has the expected SHA-256, or -1 otherwise.
+ */
+static int32_t digest_check(void)
+{
+    uint8_t hash[SHA256_SIZE];
+    uint8_t diff = 0;
+    uint32_t i;
+
+    // hash any unchanged pages after the last one sent
+    digest_update((const uint8_t *)(digest.dst + digest.pos), digest.size - digest.pos);
+    crypto_sha256_out(&digest.ctx, hash);
+    digest.active = false;
+
+    for (i = 0; i < SHA256_SIZE; i++) {
+        diff |= hash[i] ^ digest.expected[i];
+    }
+
+    return (digest.error || diff) ? -1 : 0;
+}
+
+
+/**
+ * @brief Compute the CRC-32 the verification status is written with.
+ * 
+ * @param slot is the firmware slot.
+ * @return the CRC-32 of the firmware size, version and hash.
+ */
+static uint32_t metadata_crc(uint32_t slot)
+{
+    uint32_t words[2 + (SHA256_SIZE >> 2)];
+
+    metadata_read_words(words, META_SIZE(slot), 2);
+    metadata_read_words(&words[2], META_HASH(slot), SHA256_SIZE >> 2);
+    return Crc32(0xFFFFFFFF, (uint8_t *)words, sizeof(words)) ^ 0xFFFFFFFF;
+}
+
+
+/**
+ * @brief Check whether the firmware in a slot passed verification.
+ * 
+ * @param slot is the firmware slot.
+ * @return true if the last update was completed and its digest checked, and
+ * the metadata is still what was checked.
+ */
+static bool firmware_verified(uint32_t slot)
+{
+    return (metadata_read(META_STATUS(slot)) == FIRMWARE_VERIFIED) &&
+           (metadata_read(META_STATUS_CRC(slot)) == metadata_crc(slot));
+}
+
+
+/**
+ * @brief Record that the firmware in a slot matches its hash.
+ * 
+ * The scrub counter starts again from 0.
+ * 
+ * @param slot is the firmware slot.
+ * @return 0 on success, or -1 if the status could not be written.
+ */
+static int32_t firmware_set_verified(uint32_t slot)
+{
+    if ((metadata_write(0, META_SCRUB(slot)) != 0) ||
+            (metadata_write(metadata_crc(slot), META_STATUS_CRC(slot)) != 0)) {
+        return -1;
+    }
+
+    return metadata_write(FIRMWARE_VERIFIED, META_STATUS(slot));
+}
+
+
+/**
+ * @brief Check the installed firmware before it is booted.
+ * 
+ * A verified image is trusted for FIRMWARE_SCRUB_BOOTS boots, each counted
+ * by the scrub counter. When the counter runs out, or the verification status
+ * is missing or does not match the metadata, the stored image is hashed again
+ * and compared with its saved hash, and a match is recorded with a fresh
+ * counter.
+ * 
+ * @param slot is the slot holding the firmware.
+ * @return 0 if the firmware may be booted, or -1 if it does not match its hash.
+ */
+static int32_t verify_firmware(uint32_t slot)
+{
+    uint32_t hash[SHA256_SIZE >> 2];
+    uint32_t used = metadata_read(META_SCRUB(slot));
+    uint32_t size;
+    int32_t error = 0;
+
+    // Fast path: no flash is read, as long as the boot can be counted
+    if (firmware_verified(slot) && (used < FIRMWARE_SCRUB_BOOTS) &&
+            (metadata_write(used + 1, META_SCRUB(slot)) == 0)) {
+        return 0;
+    }
+
+    BENCH_START(verify_start);
+    size = metadata_read(META_SIZE(slot)) & ~(SIZE_PACKED | SIZE_XIP);
+    if (size > FIRMWARE_STORAGE_PAGES * FLASH_PAGE_SIZE) {
+        return -1;
+    }
+    metadata_read_words(hash, META_HASH(slot), SHA256_SIZE >> 2);
+    digest_begin(FIRMWARE_STORAGE_PTR(slot), size, (uint8_t *)hash);
+    error = digest_check();
+    if (error == 0) {
+        // the image matches either way; a status that is not written only
+        // costs another hash on the next boot
+        firmware_set_verified(slot);
+    }
+    BENCH_STOP(BENCH_BOOT_VERIFY, verify_start);
+
+    return error;
+}
+
+
+/**
+ * @brief Start the firmware loaded by load_firmware(). Does not return.
+ * 
+ * @param slot is the slot holding the firmware.
+ */
+static void start_firmware(uint32_t slot)
+{
+    // Hand the clock and UART back to the firmware in their reset state
+#ifdef BENCHMARK
+    bench_deinit();
+#endif
+    clock_deinit();
+    uart_deinit();
+
+    // Execute the firmware, from flash if it was linked to run there
+    if (metadata_read(META_SIZE(slot)) & SIZE_XIP) {
+        boot_in_place(FIRMWARE_STORAGE_PTR(slot));
+    }
+    void (*firmware)(void) = (void (*)(void))(FIRMWARE_BOOT_PTR + 1);
+    firmware();
+}
+
+
+#ifdef AUTOBOOT_MS
+/**
+ * @brief Boot a verified firmware unless the host claims the bootloader first.
+ * 
+ * Waits up to AUTOBOOT_MS after reset for a host command. If none arrives,
+ * the installed firmware is started without a word on the host interface, as
+ * long as its verification status is valid and it passes verify_firmware(). Otherwise, or once
+ * the host has sent a byte, the bootloader carries on serving commands; the
+ * byte stays in the receive buffer for the command loop.
+ */
+static void autoboot(void)
+{
+    uint32_t slot = slot_active();
+
+    if (uart_wait(HOST_UART, AUTOBOOT_MS)) {
+        return;
+    }
+    if (!metadata_ready || !firmware_verified(slot) || (verify_firmware(slot) != 0) ||
+            (load_firmware(slot) != 0)) {
+        return;
+    }
+    start_firmware(slot);
+}
+#endif
+
+
+/**
+ * @brief Boot the firmware.
+ */
+void handle_boot(void)
+{
+    uint32_t slot = slot_active();
+    uint8_t *rel_msg;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'B');
+
+    if (!metadata_ready || (verify_firmware(slot) != 0) || (load_firmware(slot) != 0)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    uart_writeb(HOST_UART, 'M');
+
+    // Print the release message
+    rel_msg = (uint8_t *)FIRMWARE_RELEASE_MSG_PTR(slot);
+    while (*rel_msg != 0) {
+        uart_writeb(HOST_UART, *rel_msg);
+        rel_msg++;
+    }
+    uart_writeb(HOST_UART, '\0');
+
+    start_firmware(slot);
+}
+
+
+/**
+ * @brief Check the header of a windowed transfer frame.
+ * 
+ * An addressed frame starts with its page index ahead of the common header;
+ * the CRC-32 covers the page index as well as the payload.
+ * 
+ * @param frame is a pointer to the frame header, followed by the payload.
+ * @param header is the header size, FRAME_HEADER_SIZE or FRAME_HEADER_MAX.
+ * @param seq is the expected sequence number.
+ * @param len is the expected payload length.
+ * @return true if the sequence number, length and CRC-32 match.
+ */
+static bool frame_valid(uint8_t *frame, uint32_t header, uint32_t seq, uint32_t len)
+{
+    uint8_t *common = frame + header - FRAME_HEADER_SIZE;
+    uint32_t crc;
+
+    if ((((uint32_t)common[0] << 8) | common[1]) != seq) {
+        return false;
+    }
+    if ((((uint32_t)common[2] << 8) | common[3]) != len) {
+        return false;
+    }
+
+    crc = ((uint32_t)common[4] << 24) | ((uint32_t)common[5] << 16) |
+          ((uint32_t)common[6] << 8) | (uint32_t)common[7];
+
+    return crc == (Crc32(Crc32(0xFFFFFFFF, frame, header - FRAME_HEADER_SIZE),
+                         frame + header, len) ^ 0xFFFFFFFF);
+}
+
+
+/**
+ * @brief Abort a transfer and tell the host.
+ * 
+ * Whatever the host still has in flight is drained first, so that no frame
+ * data is taken for commands once the transfer is over.
+ * 
+ * @param interface is the base address of the UART interface of the transfer.
+ * @param window is the transfer window, 0 for stop-and-wait.
+ * @param seq is the frame sequence number the abort refers to.
+ */
+static void load_abort(uint32_t interface, uint32_t window, uint32_t seq)
+{
+    uart_rx_end(interface);
+    uart_drain(interface, LOAD_DRAIN_MS);
+    if (window) {
+        send_frame_status(FRAME_ABORT, seq);
+    } else {
+        uart_writeb(HOST_UART, FRAME_BAD);
+    }
+}
+
+
+/**
+ * @brief Check whether a flash page already holds the given data.
+ * 
+ * @param page is a pointer to a full, word-aligned page of data.
+ * @param addr is the page address in flash.
+ * @return true if the page matches flash word-for-word.
+ */
+static bool page_unchanged(uint32_t *page, uint32_t addr)
+{
+    int i;
+    uint32_t *flash = (uint32_t *)addr;
+
+    for (i = 0; i < (FLASH_PAGE_SIZE >> 2); i++) {
+        if (page[i] != flash[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Check whether a flash page is erased.
+ * 
+ * @param addr is the page address in flash.
+ * @return true if every word of the page reads 0xFFFFFFFF.
+ */
+static bool page_blank(uint32_t addr)
+{
+    int i;
+    uint32_t *flash = (uint32_t *)addr;
+
+    for (i = 0; i < (FLASH_PAGE_SIZE >> 2); i++) {
+        if (flash[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Program a full page of flash, unless it already holds the data.
+ * 
+ * @param addr is the page address in flash.
+ * @param page is a pointer to a full, word-aligned page of data.
+ * @param skipped is set if the page was left unchanged.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+static RAMFUNC int32_t program_page(uint32_t addr, uint8_t *page, bool *skipped)
+{
+    int32_t error;
+
+    digest_page(addr, page);
+
+    // leave the page alone if it already holds this data
+    BENCH_START(compare_start);
+    *skipped = page_unchanged((uint32_t *)page, addr);
+    BENCH_STOP(BENCH_PAGE_COMPARE, compare_start);
+    if (*skipped) {
+        return 0;
+    }
+
+    // clear and write flash page, unless it is blank (erased ahead)
+    if (!page_blank(addr)) {
+        BENCH_START(erase_start);
+        error = flash_erase_page(addr);
+        BENCH_STOP(BENCH_FLASH_ERASE, erase_start);
+        if (error != 0) {
+            return error;
+        }
+    }
+
+    BENCH_START(write_start);
+    error = flash_write((uint32_t *)page, addr, FLASH_PAGE_SIZE >> 2);
+    BENCH_STOP(BENCH_FLASH_WRITE, write_start);
+
+    return error;
+}
+
+
+/**
+ * @brief Program the image rebuilt by a patch to flash.
+ * 
+ * @param dst is the starting page address to store the image.
+ * @param size is the size of the image.
+ * @return 0 on success, or -1 if the patch was incomplete or an error occurs.
+ */
+static RAMFUNC int32_t program_patched(uint32_t dst, uint32_t size)
+{
+    uint8_t *image = patch_finish();
+    uint32_t offset;
+    bool skipped;
+
+    if (image == NULL) {
+        return -1;
+    }
+
+    for (offset = 0; offset < size; offset += FLASH_PAGE_SIZE) {
+        if (program_page(dst + offset, image + offset, &skipped) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Program a page of decompressed output to flash.
+ * 
+ * @param addr is the page address in flash.
+ * @param page is a pointer to a full, word-aligned page of data.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+static RAMFUNC int32_t program_inflated(uint32_t addr, uint8_t *page)
+{
+    bool skipped;
+
+    return program_page(addr, page, &skipped);
+}
+
+
+/**
+ * @brief Count the pages committed by the journaled transfer.
+ * 
+ * @return the number of pages in flash, from the first one on.
+ */
+static uint32_t journal_pages(void)
+{
+    uint32_t pages;
+
+    if (metadata_read(META_JOURNAL) != JOURNAL_MAGIC) {
+        return 0;
+    }
+    pages = metadata_read(META_JOURNAL_PAGES);
+
+    return (pages == 0xFFFFFFFF) ? 0 : pages;
+}
+
+
+/**
+ * @brief Drop the journal, once its transfer is complete or overwritten.
+ */
+static void journal_clear(void)
+{
+    journal_active = false;
+    metadata_write(0xFFFFFFFF, META_JOURNAL);
+}
+
+
+/**
+ * @brief Start journaling a transfer, or pick up the one in the journal.
+ * 
+ * Called before the header of an update or configure is acknowledged. Unless
+ * the host named a session with 'J', any journal is dropped. Otherwise the
+ * transfer starts from the number of pages already committed if the journal
+ * holds this session, destination, size and digest, or from 0 with a new
+ * journal. The host is told with journal_reply().
+ * 
+ * @param dst is the first page of the transfer.
+ * @param size is the size field of the header.
+ * @param digest is a pointer to the SHA-256 of the image, or NULL.
+ * @param resumable is false for transfers that cannot start mid-way, which
+ * always start from 0 and are not journaled.
+ * @return the frame to start the transfer from.
+ */
+static uint32_t journal_open(uint32_t dst, uint32_t size, const uint32_t *digest,
+                             bool resumable)
+{
+    uint32_t header[JOURNAL_HEADER_WORDS];
+    uint32_t journal[JOURNAL_HEADER_WORDS];
+    uint32_t first = 0;
+
+    if (!load_resumable || !resumable) {
+        journal_clear();
+        if (!load_resumable) {
+            return 0;
+        }
+    } else {
+        header[0] = JOURNAL_MAGIC;
+        header[1] = load_session;
+        header[2] = dst;
+        header[3] = size;
+        if (digest != NULL) {
+            memcpy(&header[4], digest, SHA256_SIZE);
+        } else {
+            memset(&header[4], 0xFF, SHA256_SIZE);
+        }
+
+        metadata_read_words(journal, META_JOURNAL, JOURNAL_HEADER_WORDS);
+        if (memcmp(header, journal, sizeof(header)) == 0) {
+            first = journal_pages();
+        } else {
+            // the magic goes last, so a torn header is never taken as valid
+            journal_clear();
+            metadata_write_words(&header[1], META_JOURNAL + 4, JOURNAL_HEADER_WORDS - 1);
+            metadata_write(0, META_JOURNAL_PAGES);
+            metadata_write(JOURNAL_MAGIC, META_JOURNAL);
+        }
+        journal_active = true;
+    }
+
+    return first;
+}
+
+
+/**
+ * @brief Tell the host where to carry on from, once the header has been
+ * acknowledged.
+ * 
+ * The page to start from (2B) is only sent if the host named a session with
+ * 'J'.
+ * 
+ * @param first is the frame returned by journal_open().
+ */
+static void journal_reply(uint32_t first)
+{
+    if (load_resumable) {
+        uart_writeb(HOST_UART, (uint8_t)(first >> 8));
+        uart_writeb(HOST_UART, (uint8_t)first);
+    }
+}
+
+
+#ifdef ERASE_AHEAD
+/**
+ * @brief Erase the pages of a transfer before its header is acknowledged.
+ * 
+ * Pages that already read as blank are not erased again, and program_page()
+ * does not erase blank pages, so frames then only wait for programming.
+ * 
+ * @param dst is the first page of the transfer.
+ * @param first is the frame the transfer starts from.
+ * @param size is the size of the image.
+ * @param max_pages is the number of pages at dst. handle_update() and
+ * handle_configure() refuse a larger image before this is called; nothing
+ * past dst is erased even so.
+ */
+static void erase_ahead(uint32_t dst, uint32_t first, uint32_t size, uint32_t max_pages)
+{
+    uint32_t pages = (size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    uint32_t addr;
+    uint32_t i;
+
+    if (pages > max_pages) {
+        return;
+    }
+
+    BENCH_START(erase_start);
+    for (i = first; i < pages; i++) {
+        addr = dst + i * FLASH_PAGE_SIZE;
+        if (!page_blank(addr)) {
+            flash_erase_page(addr);
+        }
+    }
+    BENCH_STOP(BENCH_ERASE_AHEAD, erase_start);
+}
+#endif
+
+
+/**
+ * @brief Record that a page of the journaled transfer is in flash.
+ * 
+ * @param page is the page index, committed in order.
+ */
+static void journal_commit(uint32_t page)
+{
+    if (journal_active) {
+        metadata_write(page + 1, META_JOURNAL_PAGES);
+    }
+}
+
+
+/**
+ * @brief Make a firmware update active once its last frame is in flash.
+ * 
+ * Set as load_finish by handle_update(), so it runs once the digest has
+ * checked out and before the last frame is acknowledged. The update is in the
+ * slot that is not active yet.
+ * 
+ * @return 0 if the update is verified and active, or -1 if it cannot be.
+ */
+static int32_t finish_update(void)
+{
+    uint32_t slot = SLOT_OTHER(slot_active());
+    uint32_t size = metadata_read(META_SIZE(slot));
+
+    // An image executed in place must have been linked for this slot, and
+    // the image is not hashed again when booted, and booted from now on
+    if (((size & SIZE_XIP) && (check_vectors(FIRMWARE_STORAGE_PTR(slot), size & ~SIZE_XIP) != 0)) ||
+            (firmware_set_verified(slot) != 0) || (slot_select(slot) != 0)) {
+        // nothing is left to resume
+        journal_clear();
+        return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * @brief Read data from a UART interface and program to flash memory.
  * 
+ * Frames are received in the background (by uDMA when built with UART_DMA)
+ * into one frame buffer while the previous frame is erased and programmed.
+ * 
+ * With a window of 0 the host sends raw 1KB frames and waits for a FRAME_OK
+ * after each. Frames are acknowledged as soon as they have been received, so
+ * the next one arrives during the flash operation; the last frame is
+ * acknowledged once it is in flash, and a flash error is reported with
+ * FRAME_BAD in place of the next acknowledgement.
+ * 
+ * With a window of 1..LOAD_WINDOW_MAX the host keeps up to that many frames in
+ * flight. Each frame carries a header with its sequence number, payload length
+ * and payload CRC-32. Frames are acknowledged cumulatively with FRAME_OK once
+ * programmed; a bad frame is answered with FRAME_BAD naming the frame to
+ * resend from (go-back-N). Everything received up to an idle line is dropped
+ * first, so that a lost byte does not leave every later frame out of step.
+ * 
+ * In a delta transfer (windowed only) the host first sends the number of
+ * frames (2B) and then only the pages that differ from flash, each as a full
+ * 1KB addressed frame whose header also names the page it is for.
+ * 
+ * In a patch transfer the host first sends the patch size (4B) and then the
+ * patch in frames. The patch is applied as it arrives (see patch_begin(),
+ * which must have been called), and the rebuilt image is programmed once the
+ * last frame has been applied, before that frame is acknowledged.
+ * 
+ * In a compressed transfer the host likewise sends the compressed size (4B)
+ * first. Each frame is decompressed into the page buffer given to lz_begin(),
+ * which must have been called, and every page is programmed as soon as it is
+ * full.
+ * 
+ * With LOAD_SECURE every frame is decrypted as it is taken from its buffer
+ * (see cipher_begin(), which must have been called), with frames padded to the
+ * AES block size on the wire. Each page is added to the digest started with
+ * digest_begin() as it is programmed, and the digest is checked before the
+ * last frame is acknowledged, so the image is never read back. So is
+ * load_finish, when set.
+ * 
+ * With LOAD_AEAD as well, every frame payload is followed by a Poly1305 tag
+ * (see aead_begin(), which must have been called). The frame is authenticated
+ * before it is used and the transfer aborts on the first forged frame, so
+ * nothing that was tampered with is ever programmed.
+ * 
+ * Pages that already hold the received data are neither erased nor
+ * programmed; in windowed transfers they are acknowledged with FRAME_SKIPPED.
+ * 
+ * A full transfer can start from a later frame, to resume one that was cut
+ * off (see journal_open()). The pages before it are taken from flash, and
+ * every page but the last is committed to the journal once programmed.
+ * 
+ * When a transfer is aborted, the frames still in flight are drained before
+ * the host is told, so none of their bytes reach the command loop. A frame
+ * that does not arrive within LOAD_TIMEOUT_MS aborts the transfer as well, so
+ * that a host that lost the link can reconnect and resume it.
+ * 
+ * The receive loop runs from SRAM together with the flash driver, so it is not
+ * held off while a page is being erased or programmed.
+ * 
  * @param interface is the base address of the UART interface to read from.
  * @param dst is the starting page address to store the data.
+ * @param max_pages is the number of pages at dst. Nothing is programmed
+ * beyond them.
  * @param size is the number of bytes to load.
+ * @param window is the negotiated transfer window, 0 for stop-and-wait.
+ * @param mode is the transfer type: LOAD_PAGES, LOAD_DELTA, LOAD_PATCH or LOAD_LZ,
+ * with LOAD_SECURE (and LOAD_AEAD) for an encrypted firmware update.
+ * @param first is the frame to start from, 0 unless a transfer is resumed.
+ * @return 0 on success, or -1 if the transfer was aborted.
  */
-void load_data(uint32_t interface, uint32_t dst, uint32_t size)
+RAMFUNC int32_t load_data(uint32_t interface, uint32_t dst, uint32_t max_pages, uint32_t size,
+                          uint32_t window, uint32_t mode, uint32_t first)
 {
     int i;
+    uint32_t pages;
+    uint32_t stream;
+    uint32_t wire = 0;
+    uint32_t frames;
+    uint32_t header;
+    uint32_t limit;
+    uint32_t next_tx = 0;
+    uint32_t acked = 0;
+    uint32_t retries = 0;
+    uint32_t seq[LOAD_BUFFERS];
+    int32_t rx[LOAD_BUFFERS];
+    uint32_t pend_head = 0;
+    uint32_t pend_count = 0;
+    uint32_t buf;
     uint32_t frame_size;
-    uint8_t page_buffer[FLASH_PAGE_SIZE];
-
-    while(size > 0) {
-        // calculate frame size
-        frame_size = size > FLASH_PAGE_SIZE ? FLASH_PAGE_SIZE : size;
-        // read frame into buffer
-        uart_read(HOST_UART, page_buffer, frame_size);
-        // pad buffer if frame is smaller than the page
-        for(i = frame_size; i < FLASH_PAGE_SIZE; i++) {
-            page_buffer[i] = 0xFF;
+    uint8_t *frame;
+    uint8_t *page_buffer;
+    uint32_t page;
+    uint32_t addr;
+    uint32_t polls;
+    uint32_t delay;
+    int32_t error;
+    bool skipped;
+    bool secure = (mode & LOAD_SECURE) != 0;
+    bool sealed = (mode & LOAD_AEAD) != 0;
+    uint32_t tag = sealed ? FRAME_TAG_SIZE : 0;
+
+    mode &= ~(LOAD_SECURE | LOAD_AEAD);
+    pages = (size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    if (pages > max_pages) {
+        return -1;
+    }
+    stream = size;
+    header = window ? FRAME_HEADER_SIZE : 0;
+
+    if ((mode == LOAD_DELTA) && window) {
+        // Receive the number of addressed pages that follow
+        frames = ((uint32_t)uart_readb(interface)) << 8;
+        frames |= (uint32_t)uart_readb(interface);
+        header = FRAME_HEADER_MAX;
+    } else {
+        if ((mode == LOAD_PATCH) || (mode == LOAD_LZ)) {
+            // Receive the size of the patch or compressed image that follows
+            stream = ((uint32_t)uart_readb(interface)) << 24;
+            stream |= ((uint32_t)uart_readb(interface)) << 16;
+            stream |= ((uint32_t)uart_readb(interface)) << 8;
+            stream |= (uint32_t)uart_readb(interface);
         }
-        // clear flash page
-        flash_erase_page(dst);
-        // write flash page
-        flash_write((uint32_t *)page_buffer, dst, FLASH_PAGE_SIZE >> 2);
-        // next page and decrease size
-        dst += FLASH_PAGE_SIZE;
-        size -= frame_size;
-        // send frame ok
-        uart_writeb(HOST_UART, FRAME_OK);
+        // CBC encrypted frames carry whole cipher blocks
+        wire = (secure && !sealed) ? ((stream + AES_BLOCK_SIZE - 1) & ~(AES_BLOCK_SIZE - 1)) : stream;
+        frames = (wire + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
     }
-}
-
-static void compute_sha256(const void *data, int len, void *out)
-{
-    br_sha256_context csha256;
-
-    br_sha256_init(&csha256);
-    br_sha256_update(&csha256, data, len);
-    br_sha256_out(&csha256, out);
-
-    return;
-}
 
-static void do_AES_decrypt(char *enc_data, int len,
-    const br_block_cbcenc_class *ve,
-    const br_block_cbcdec_class *vd)
-{
-    static unsigned char key[32]; //16
-    static unsigned char iv[16];
-    size_t key_len;
-    br_aes_gen_cbcdec_keys v_dc;
-    const br_block_cbcdec_class **dc;
+    if (frames == 0) {
+        error = secure ? digest_check() : 0;
+        if ((error == 0) && (load_finish != NULL)) {
+            error = load_finish();
+        }
+        return error;
+    }
 
-    if (ve->block_size != 16 || vd->block_size != 16
-            || ve->log_block_size != 4 || vd->log_block_size != 4)
-    {
-        return;
+    // a resumed transfer still ends with its last frame
+    if (first >= frames) {
+        return -1;
     }
+    next_tx = first;
+    acked = first;
+
+    // Frames are waited for in 100us polls; SysCtlDelay() takes 3 cycles per
+    // loop
+    delay = SysCtlClockGet() / 30000;
+
+    BENCH_START(load_start);
+
+    uart_rx_begin(interface);
+
+    while (acked < frames) {
+        // Queue free buffers for the frames the host may send next. Buffers
+        // are used round-robin, so they complete in the order submitted.
+        limit = window ? (acked + window) : frames;
+        while ((pend_count < LOAD_BUFFERS) && (next_tx < frames) && (next_tx < limit)) {
+            buf = (pend_head + pend_count) % LOAD_BUFFERS;
+            if (header == FRAME_HEADER_MAX) {
+                frame_size = FLASH_PAGE_SIZE;
+            } else {
+                frame_size = (wire - next_tx * FLASH_PAGE_SIZE) > FLASH_PAGE_SIZE ?
+                    FLASH_PAGE_SIZE : (wire - next_tx * FLASH_PAGE_SIZE);
+            }
+            rx[buf] = uart_rx_submit(interface,
+                                     (uint8_t *)frame_buffers[buf] + FRAME_HEADER_MAX - header,
+                                     header + frame_size + tag);
+            seq[buf] = next_tx++;
+            pend_count++;
+        }
 
-    dc = &v_dc.vtable;
-    key_len = sizeof(aes_key);
-    memcpy(key, aes_key, sizeof(aes_key));
-#if 1
-    vd->init(dc, key, key_len);
-    memset(iv, 0, sizeof iv);
-    vd->run(dc, iv, enc_data, len);
-#endif
-}
+        // wait for the oldest frame to arrive
+        buf = pend_head;
+        BENCH_START(wait_start);
+        polls = LOAD_TIMEOUT_MS * 10;
+        while (!uart_rx_done(interface, rx[buf])) {
+            // the link dropped; the journal is kept for the host to resume
+            if (polls == 0) {
+                load_abort(interface, window, seq[buf]);
+                return -1;
+            }
+            polls--;
+            SysCtlDelay(delay);
+        }
+        BENCH_STOP(BENCH_RX_WAIT, wait_start);
+        pend_head = (pend_head + 1) % LOAD_BUFFERS;
+        pend_count--;
+
+        frame = (uint8_t *)frame_buffers[buf] + FRAME_HEADER_MAX - header;
+        page_buffer = (uint8_t *)frame_buffers[buf] + FRAME_HEADER_MAX;
+        if (header == FRAME_HEADER_MAX) {
+            page = ((uint32_t)frame[0] << 8) | frame[1];
+            frame_size = FLASH_PAGE_SIZE;
+        } else {
+            page = seq[buf];
+            frame_size = (wire - page * FLASH_PAGE_SIZE) > FLASH_PAGE_SIZE ?
+                FLASH_PAGE_SIZE : (wire - page * FLASH_PAGE_SIZE);
+        }
+        addr = dst + page * FLASH_PAGE_SIZE;
+
+        if (window) {
+            // drop frames the host sent before it saw our last NAK
+            if (seq[buf] != acked) {
+                continue;
+            }
+
+            // ask the host to go back to this frame
+            if (!frame_valid(frame, header, seq[buf], frame_size + tag)) {
+                if (++retries > LOAD_MAX_RETRIES) {
+                    load_abort(interface, window, seq[buf]);
+                    return -1;
+                }
+                // get back in step with the host: drop the frames queued
+                // after this one and whatever else is on the line
+                uart_rx_end(interface);
+                uart_drain(interface, LOAD_DRAIN_MS);
+                uart_rx_begin(interface);
+                pend_count = 0;
+
+                send_frame_status(FRAME_BAD, seq[buf]);
+                next_tx = seq[buf];
+                continue;
+            }
+
+            // an addressed page has to lie within the image
+            if ((header == FRAME_HEADER_MAX) && (page >= pages)) {
+                load_abort(interface, window, seq[buf]);
+                return -1;
+            }
+        } else if (acked + 1 < frames) {
+            // let the host send the next frame while this one is programmed
+            uart_writeb(HOST_UART, FRAME_OK);
+        }
 
-/**
- * @brief Decrypt firmware
- * 
- * @return : 0 on success, -1 on failure.
- */
+        error = 0;
+        if (sealed) {
+            // authenticate and decrypt in place
+            error = aead_open(page_buffer, frame_size, page);
+        } else if (secure) {
+            // decrypt in place, and drop the cipher padding of the last frame
+            cipher_run(page_buffer, frame_size);
+            if ((header != FRAME_HEADER_MAX) && (frame_size > stream - page * FLASH_PAGE_SIZE)) {
+                frame_size = stream - page * FLASH_PAGE_SIZE;
+            }
+        }
 
-int decrypt_firmware(unsigned char *image, unsigned int totalsize)
-{
-    unsigned int image_size = 0;
-    static unsigned char hash[32];
-    static unsigned char decrypted_hash[32];
-    int i = 0;
+        if (error != 0) {
+            // a forged frame is never programmed
+        } else if (mode == LOAD_PATCH) {
+            // apply the patch, and program the new image after the last frame
+            skipped = false;
+            error = patch_feed(page_buffer, frame_size);
+            if ((error == 0) && (acked + 1 == frames)) {
+                error = program_patched(dst, size);
+            }
+        } else if (mode == LOAD_LZ) {
+            // decompress, programming each page once it is complete
+            skipped = false;
+            error = lz_feed(page_buffer, frame_size);
+            if ((error == 0) && (acked + 1 == frames)) {
+                error = lz_finish();
+            }
+        } else {
+            // pad buffer if frame is smaller than the page, and never program
+            // outside the region
+            for(i = frame_size; i < FLASH_PAGE_SIZE; i++) {
+                page_buffer[i] = 0xFF;
+            }
+            error = (page < max_pages) ? program_page(addr, page_buffer, &skipped) : -1;
+            if ((error == 0) && (acked + 1 < frames)) {
+                journal_commit(page);
+            }
+        }
+        if ((error == 0) && secure && (acked + 1 == frames)) {
+            // the whole image is in, check it before the last acknowledgement;
+            // a mismatch is not worth resuming
+            error = digest_check();
+            if (error != 0) {
+                journal_clear();
+            }
+        }
+        if ((error == 0) && (load_finish != NULL) && (acked + 1 == frames)) {
+            error = load_finish();
+        }
+        if (error != 0) {
+            load_abort(interface, window, seq[buf]);
+            return -1;
+        }
 
-    if (NULL == image)
-    {
-        return -1;
+        acked++;
+        retries = 0;
+        if (window) {
+            send_frame_status(skipped ? FRAME_SKIPPED : FRAME_OK, seq[buf]);
+        }
     }
 
-    // Get the actual size of the software image
-    memcpy(&image_size, &image[FIRMWARE_SIZE_PTR], 4);
-    /*g_ui32ImageSize = image_size;
+    uart_rx_end(interface);
 
-    // Decrypt the encrypted AES key & store it
-    if (!br_rsa_i15_private((unsigned char *)&image[AES_KEY_OFFSET], &RSA_SK)) {
-        ERROR( "RSA decryption of AES key failed (1)\r");
-        return 1;
+    // send frame ok for the last page once it is in flash
+    if (!window) {
+        uart_writeb(HOST_UART, FRAME_OK);
     }
-    memcpy(aes_key, &image[AES_KEY_OFFSET], sizeof(aes_key));
-     
 
+    BENCH_STOP(BENCH_LOAD, load_start);
 
-    if (!br_rsa_i15_pkcs1_vrfy((unsigned char *)&image[SHA256_OFFSET], SHA256_SIZE, BR_HASH_OID_SHA256, \
-                sizeof (decrypted_hash), &RSA_PK, decrypted_hash))
-    {
-        ERROR("Signature verification failed (2)\r");
-        return -1;
-    }
-    */
-    // Decrypt the application with the AES key 
-   do_AES_decrypt(FIRMWARE_DATA_PTR  , image_size,
-        &br_aes_big_cbcenc_vtable,
-        &br_aes_big_cbcdec_vtable);
-
-    // Perform SHA256 sum check and store the result on `hash`
-    compute_sha256(FIRMWARE_DATA_PTR, image_size, hash);
+    return 0;
+}
 
-    // check if hash== FIRMWARE_HASH_PTR
-    for(i=0; i<32; i++){
-        if (hash[i] != FIRMWARE_HASH_PTR[i]){
+/**
+ * @brief Convert a hexadecimal string to bytes.
+ * 
+ * @param hex is a pointer to 2 * len hexadecimal digits.
+ * @param out is a pointer to the len byte result.
+ * @param len is the number of bytes.
+ * @return 0 on success, or -1 if a character is not a hexadecimal digit.
+ */
+static int32_t parse_hex(const uint8_t *hex, uint8_t *out, uint32_t len)
+{
+    uint32_t i;
+    uint8_t c;
+    uint8_t nibble;
+
+    for (i = 0; i < 2 * len; i++) {
+        c = hex[i];
+        if ((c >= '0') && (c <= '9')) {
+            nibble = c - '0';
+        } else if ((c >= 'a') && (c <= 'f')) {
+            nibble = c - 'a' + 10;
+        } else if ((c >= 'A') && (c <= 'F')) {
+            nibble = c - 'A' + 10;
+        } else {
             return -1;
         }
+        out[i >> 1] = (i & 1) ? (out[i >> 1] | nibble) : (nibble << 4);
     }
+
     return 0;
 }
 
+
 /**
  * @brief Update the firmware.
+ * 
+ * The update is written to the slot that is not active, so the running image
+ * survives a failed update, and becomes active once it has been verified.
  */
 void handle_update(void)
 {
     // metadata
+    uint32_t active = slot_active();
+    uint32_t slot = SLOT_OTHER(active);
     uint32_t current_version;
     uint32_t version = 0;
     uint32_t size = 0;
     uint32_t rel_msg_size = 0;
+    uint32_t old_size;
+    uint32_t mode = load_mode;
+    uint32_t stored;
+    uint32_t sealed;
+    uint32_t header_size;
+    uint32_t first;
     uint8_t rel_msg[1025]; // 1024 + terminator
     uint8_t sha256_hash[65]; // 64 + terminator
     uint8_t sha256_size = 0;
-    uint8_t ret = 0;
+    uint32_t expected[SHA256_SIZE >> 2];
+    uint8_t iv[AES_BLOCK_SIZE];
+    uint32_t link = 0;
+    uint32_t i;
+    int32_t error;
+    bool skipped;
 
     // Acknowledge the host
     uart_writeb(HOST_UART, 'U');
@@ -307,8 +1581,26 @@ void handle_update(void)
     // Recieve SHA 256 hash
     sha256_size = uart_readline(HOST_UART, sha256_hash) + 1; // Include terminator
 
+    // Receive the IV of the encrypted image
+    for (i = 0; i < AES_BLOCK_SIZE; i++) {
+        iv[i] = (uint8_t)uart_readb(HOST_UART);
+    }
+
+    // Receive the address an XIP image is linked for (see handle_target())
+    if (size & SIZE_XIP) {
+        link = ((uint32_t)uart_readb(HOST_UART)) << 24;
+        link |= ((uint32_t)uart_readb(HOST_UART)) << 16;
+        link |= ((uint32_t)uart_readb(HOST_UART)) << 8;
+        link |= (uint32_t)uart_readb(HOST_UART);
+    }
+
+    if ((sha256_size != sizeof(sha256_hash)) || (parse_hex(sha256_hash, (uint8_t *)expected, SHA256_SIZE) != 0)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
     // Check the version
-    current_version = *((uint32_t *)FIRMWARE_VERSION_PTR);
+    current_version = metadata_read(META_VERSION(active));
     if (current_version == 0xFFFFFFFF) {
         current_version = (uint32_t)OLDEST_VERSION;
     }
@@ -319,50 +1611,124 @@ void handle_update(void)
         return;
     }
 
-    // Clear firmware metadata
-    flash_erase_page(FIRMWARE_METADATA_PTR);
+    // A packed image is stored as is, and inflated when booted; an XIP image
+    // is booted where it is stored, so it cannot be packed
+    header_size = size;
+    stored = size & (SIZE_PACKED | SIZE_XIP);
+    size &= ~(SIZE_PACKED | SIZE_XIP);
+    if (stored == (SIZE_PACKED | SIZE_XIP)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    // An XIP image only runs in the slot it was linked for, so one linked
+    // for the active slot is refused before the other slot is touched
+    if ((stored & SIZE_XIP) && (link != FIRMWARE_STORAGE_PTR(slot))) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    // Sealed frames are authenticated one by one
+    sealed = size & SIZE_AEAD;
+    size &= ~SIZE_AEAD;
+
+    // A compressed image is decompressed as it arrives
+    if (size & SIZE_COMPRESSED) {
+        size &= ~SIZE_COMPRESSED;
+        if (mode != LOAD_PAGES) {
+            uart_writeb(HOST_UART, FRAME_BAD);
+            return;
+        }
+        mode = LOAD_LZ;
+    }
+
+    // The image has to fit its slot, so the other slot is never written; a
+    // patched image is rebuilt in the boot RAM, which is the same size
+    if (size > FIRMWARE_STORAGE_PAGES * FLASH_PAGE_SIZE) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+    old_size = metadata_read(META_SIZE(active)) & ~(SIZE_PACKED | SIZE_XIP);
+
+    // Clear the verification status first, so the slot is never taken for
+    // verified while its metadata and image are replaced
+    if (!metadata_ready || (metadata_write(0xFFFFFFFF, META_STATUS(slot)) != 0)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
 
     // Only save new version if it is not 0
     if (version != 0) {
-        flash_write_word(version, FIRMWARE_VERSION_PTR);
+        error = metadata_write(version, META_VERSION(slot));
     } else {
-        flash_write_word(current_version, FIRMWARE_VERSION_PTR);
+        error = metadata_write(current_version, META_VERSION(slot));
     }
 
     // Save size
-    flash_write_word(size, FIRMWARE_SIZE_PTR);
-
-    // Write release message
-    uint8_t *rel_msg_read_ptr = rel_msg;
-    uint32_t rel_msg_write_ptr = FIRMWARE_RELEASE_MSG_PTR;
-    uint32_t rem_bytes = rel_msg_size;
-
-    // If release message goes outside of the first page, write the first full page
-    if (rel_msg_size > (FLASH_PAGE_SIZE-8)) {
-
-        // Write first page
-        flash_write((uint32_t *)rel_msg, FIRMWARE_RELEASE_MSG_PTR, (FLASH_PAGE_SIZE-8) >> 2); // This is always a multiple of 4
+    error |= metadata_write(size | stored, META_SIZE(slot));
+
+    // Save the hash the image is checked against when it is booted
+    error |= metadata_write_words(expected, META_HASH(slot), SHA256_SIZE >> 2);
+
+    // Write release message, padded to whole pages in the (unused) boot RAM;
+    // pages that already hold it are not erased
+    memset((uint8_t *)FIRMWARE_BOOT_PTR, 0xFF, FIRMWARE_RELEASE_MSG_PAGES * FLASH_PAGE_SIZE);
+    memcpy((uint8_t *)FIRMWARE_BOOT_PTR, rel_msg, rel_msg_size);
+    for (i = 0; i < FIRMWARE_RELEASE_MSG_PAGES; i++) {
+        error |= program_page(FIRMWARE_RELEASE_MSG_PTR(slot) + i * FLASH_PAGE_SIZE,
+                              (uint8_t *)(FIRMWARE_BOOT_PTR + i * FLASH_PAGE_SIZE), &skipped);
+    }
 
-        // Set up second page
-        rem_bytes = rel_msg_size - (FLASH_PAGE_SIZE-8);
-        rel_msg_read_ptr = rel_msg + (FLASH_PAGE_SIZE-8);
-        rel_msg_write_ptr = FIRMWARE_RELEASE_MSG_PTR2;
-        flash_erase_page(rel_msg_write_ptr);
+    if (error != 0) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
     }
 
-    // Program last or only page of release message
-    if (rem_bytes % 4 != 0) {
-        rem_bytes += 4 - (rem_bytes % 4); // Account for partial word
+    // Sealed frames of a full transfer can be resumed, CBC chains cannot
+    first = journal_open(FIRMWARE_STORAGE_PTR(slot), header_size, expected,
+                         (mode == LOAD_PAGES) && sealed);
+
+#ifdef ERASE_AHEAD
+    // Every page of the image is programmed in turn, unless only the pages
+    // that differ are sent
+    if (mode != LOAD_DELTA) {
+        erase_ahead(FIRMWARE_STORAGE_PTR(slot), first, size, FIRMWARE_STORAGE_PAGES);
     }
-    flash_write((uint32_t *)rel_msg_read_ptr, rel_msg_write_ptr, rem_bytes >> 2);
+#endif
 
     // Acknowledge
     uart_writeb(HOST_UART, FRAME_OK);
+    journal_reply(first);
     
-    // Retrieve firmware
-    load_data(HOST_UART, FIRMWARE_STORAGE_PTR, size);
+    // Retrieve firmware, patching the active image into the other slot or
+    // decompressing through a page buffer in the (unused) boot RAM. Frames are
+    // authenticated or decrypted, and the image hashed, as it is programmed.
+    if (sealed) {
+        aead_begin(iv, version, header_size);
+    } else {
+        cipher_begin(iv);
+    }
+    digest_begin(FIRMWARE_STORAGE_PTR(slot), size, (uint8_t *)expected);
+    if (mode == LOAD_PATCH) {
+        patch_begin((uint8_t *)FIRMWARE_STORAGE_PTR(active), old_size, (uint8_t *)FIRMWARE_BOOT_PTR, size);
+    } else if (mode == LOAD_LZ) {
+        lz_begin(FIRMWARE_STORAGE_PTR(slot), (uint8_t *)FIRMWARE_BOOT_PTR, FLASH_PAGE_SIZE, size,
+                 program_inflated);
+    }
+    mode |= LOAD_SECURE | (sealed ? LOAD_AEAD : 0);
+    load_finish = finish_update;
+    error = load_data(HOST_UART, FIRMWARE_STORAGE_PTR(slot), FIRMWARE_STORAGE_PAGES, size,
+                      load_window, mode, first);
+    load_finish = NULL;
+    if (error != 0) {
+        // Never boot a partial, damaged or unusable image; clearing the size
+        // keeps the version
+        digest.active = false;
+        metadata_write(0, META_SIZE(slot));
+        return;
+    }
 
-    ret = decrypt_firmware(FIRMWARE_BOOT_PTR, FIRMWARE_SIZE_PTR);
+    journal_clear();
 }
 
 
@@ -372,6 +1738,9 @@ void handle_update(void)
 void handle_configure(void)
 {
     uint32_t size = 0;
+    uint32_t header_size;
+    uint32_t mode = load_mode;
+    uint32_t first;
 
     // Acknowledge the host
     uart_writeb(HOST_UART, 'C');
@@ -381,14 +1750,362 @@ void handle_configure(void)
     size |= (((uint32_t)uart_readb(HOST_UART)) << 16);
     size |= (((uint32_t)uart_readb(HOST_UART)) << 8);
     size |= ((uint32_t)uart_readb(HOST_UART));
+    header_size = size;
+
+    // A compressed image is decompressed as it arrives
+    if (size & SIZE_COMPRESSED) {
+        size &= ~SIZE_COMPRESSED;
+        if (mode != LOAD_PAGES) {
+            uart_writeb(HOST_UART, FRAME_BAD);
+            return;
+        }
+        mode = LOAD_LZ;
+    }
+
+    // Patches only apply to firmware
+    if (mode == LOAD_PATCH) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    // The configuration has to fit its storage
+    if (size > CONFIGURATION_STORAGE_PAGES * FLASH_PAGE_SIZE) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    if (!metadata_ready || (metadata_write(size, META_CONFIG_SIZE) != 0)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
 
-    flash_erase_page(CONFIGURATION_METADATA_PTR);
-    flash_write_word(size, CONFIGURATION_SIZE_PTR);
+    // A full transfer can be resumed
+    first = journal_open(CONFIGURATION_STORAGE_PTR, header_size, NULL, mode == LOAD_PAGES);
+
+#ifdef ERASE_AHEAD
+    if (mode != LOAD_DELTA) {
+        erase_ahead(CONFIGURATION_STORAGE_PTR, first, size, CONFIGURATION_STORAGE_PAGES);
+    }
+#endif
 
     uart_writeb(HOST_UART, FRAME_OK);
+    journal_reply(first);
     
-    // Retrieve configuration
-    load_data(HOST_UART, CONFIGURATION_STORAGE_PTR, size);
+    // Retrieve configuration, decompressing through a page buffer in the
+    // (unused) boot RAM
+    if (mode == LOAD_LZ) {
+        lz_begin(CONFIGURATION_STORAGE_PTR, (uint8_t *)FIRMWARE_BOOT_PTR, FLASH_PAGE_SIZE, size,
+                 program_inflated);
+    }
+    if (load_data(HOST_UART, CONFIGURATION_STORAGE_PTR, CONFIGURATION_STORAGE_PAGES, size,
+                  load_window, mode, first) == 0) {
+        journal_clear();
+    }
+}
+
+
+/**
+ * @brief Negotiate the transfer window for the next update or configure.
+ * 
+ * The host proposes a window size and the bootloader answers with the window
+ * it grants. A window of 0 keeps the stop-and-wait protocol.
+ */
+void handle_window(void)
+{
+    uint8_t requested;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'W');
+
+    // Receive the requested window and grant what we can buffer
+    requested = (uint8_t)uart_readb(HOST_UART);
+    load_window = requested > LOAD_WINDOW_MAX ? LOAD_WINDOW_MAX : requested;
+
+    uart_writeb(HOST_UART, load_window);
+}
+
+
+/**
+ * @brief Switch the host interface to a faster baud rate.
+ * 
+ * The host proposes a rate as decimal ASCII terminated with '\n'. If the rate
+ * is supported the bootloader answers FRAME_OK, switches, and waits for the
+ * host to send the sync pattern at the new rate, which it echoes back. The
+ * host confirms that it saw the echo with BAUD_CONFIRM. If the pattern or the
+ * confirmation does not arrive in time, the bootloader falls back to the old
+ * rate, as the host does when it misses the echo. A negotiated rate lasts
+ * until the end of the next update, configure or readback.
+ */
+void handle_baudrate(void)
+{
+    uint32_t baud = 0;
+    uint32_t match = 0;
+    int32_t c;
+    int i;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'S');
+
+    // Receive the proposed rate
+    for (i = 0; i < BAUD_DIGITS_MAX; i++) {
+        c = uart_readb(HOST_UART);
+        if (c == '\n') {
+            break;
+        }
+        if ((c < '0') || (c > '9')) {
+            baud = 0;
+            break;
+        }
+        baud = (baud * 10) + (c - '0');
+    }
+
+    // Check the rate is reachable from the system clock
+    if ((baud < UART_DEFAULT_BAUD) || (baud > uart_max_baudrate())) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    // Acknowledge and switch once the acknowledgement has gone out
+    uart_writeb(HOST_UART, FRAME_OK);
+    uart_set_baudrate(HOST_UART, baud);
+
+    // Wait for the host to confirm with the sync pattern
+    while (match < sizeof(baud_sync)) {
+        c = uart_readb_timeout(HOST_UART, BAUD_SYNC_TIMEOUT_MS);
+        if (c < 0) {
+            uart_set_baudrate(HOST_UART, host_baud);
+            return;
+        }
+
+        if (c == baud_sync[match]) {
+            match++;
+        } else {
+            match = (c == baud_sync[0]) ? 1 : 0;
+        }
+    }
+
+    uart_write(HOST_UART, (uint8_t *)baud_sync, sizeof(baud_sync));
+
+    // Only keep the rate once the host has seen the echo
+    if (uart_readb_timeout(HOST_UART, BAUD_SYNC_TIMEOUT_MS) != BAUD_CONFIRM) {
+        uart_set_baudrate(HOST_UART, host_baud);
+        return;
+    }
+    host_baud = baud;
+}
+
+
+/**
+ * @brief Send a CRC-32 of every page of a storage region to the host.
+ * 
+ * The host compares these with its own image to select the pages of a delta
+ * transfer. The CRC-32 is computed over the full page, as with
+ * zlib.crc32() on the host.
+ */
+void handle_manifest(void)
+{
+    uint8_t region;
+    uint32_t address;
+    uint32_t pages;
+    uint32_t crc;
+    uint32_t i;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'H');
+
+    // Receive region identifier
+    region = (uint8_t)uart_readb(HOST_UART);
+
+    if (region == 'F') {
+        // Deltas are made against the slot the next update goes to
+        address = FIRMWARE_STORAGE_PTR(SLOT_OTHER(slot_active()));
+        pages = FIRMWARE_STORAGE_PAGES;
+    } else if (region == 'C') {
+        address = CONFIGURATION_STORAGE_PTR;
+        pages = CONFIGURATION_STORAGE_PAGES;
+    } else {
+        return;
+    }
+
+    // Acknowledge the region
+    uart_writeb(HOST_UART, region);
+
+    // Send the page count and one CRC-32 per page
+    uart_writeb(HOST_UART, (uint8_t)(pages >> 8));
+    uart_writeb(HOST_UART, (uint8_t)pages);
+
+    for (i = 0; i < pages; i++) {
+        crc = Crc32(0xFFFFFFFF, (uint8_t *)(address + i * FLASH_PAGE_SIZE), FLASH_PAGE_SIZE) ^ 0xFFFFFFFF;
+        uart_writeb(HOST_UART, (uint8_t)(crc >> 24));
+        uart_writeb(HOST_UART, (uint8_t)(crc >> 16));
+        uart_writeb(HOST_UART, (uint8_t)(crc >> 8));
+        uart_writeb(HOST_UART, (uint8_t)crc);
+    }
+}
+
+
+/**
+ * @brief Select a delta transfer of addressed pages for the next update or
+ * configure.
+ * 
+ * Addressed frames are windowed frames, so a window has to be negotiated
+ * first; the request is refused with FRAME_BAD otherwise.
+ */
+void handle_delta(void)
+{
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'D');
+
+    if (load_window != 0) {
+        load_mode = LOAD_DELTA;
+        uart_writeb(HOST_UART, FRAME_OK);
+    } else {
+        uart_writeb(HOST_UART, FRAME_BAD);
+    }
+}
+
+
+/**
+ * @brief Select a patch transfer against the installed firmware for the next
+ * update.
+ * 
+ * The host names the image its patch was made against by size (4B) and
+ * CRC-32 (4B); the request is refused with FRAME_BAD unless the installed
+ * firmware matches, so a patch is never applied to the wrong image.
+ */
+void handle_patch(void)
+{
+    uint32_t base_size;
+    uint32_t base_crc;
+    uint32_t slot;
+    uint32_t size;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'X');
+
+    // Receive the size and CRC-32 of the patch base
+    base_size = ((uint32_t)uart_readb(HOST_UART)) << 24;
+    base_size |= ((uint32_t)uart_readb(HOST_UART)) << 16;
+    base_size |= ((uint32_t)uart_readb(HOST_UART)) << 8;
+    base_size |= (uint32_t)uart_readb(HOST_UART);
+
+    base_crc = ((uint32_t)uart_readb(HOST_UART)) << 24;
+    base_crc |= ((uint32_t)uart_readb(HOST_UART)) << 16;
+    base_crc |= ((uint32_t)uart_readb(HOST_UART)) << 8;
+    base_crc |= (uint32_t)uart_readb(HOST_UART);
+
+    // Check the active firmware against the base; a packed image keeps
+    // SIZE_PACKED in its size and never matches, an XIP image is patched as is
+    slot = slot_active();
+    size = metadata_read(META_SIZE(slot)) & ~SIZE_XIP;
+    if ((size != base_size) || (size > FIRMWARE_STORAGE_PAGES * FLASH_PAGE_SIZE) ||
+            ((Crc32(0xFFFFFFFF, (uint8_t *)FIRMWARE_STORAGE_PTR(slot), size) ^ 0xFFFFFFFF) != base_crc)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    load_mode = LOAD_PATCH;
+    uart_writeb(HOST_UART, FRAME_OK);
+}
+
+
+/**
+ * @brief Name the next update or configure so that it can be resumed.
+ * 
+ * The host sends a session ID (4B) and is answered with the number of pages
+ * (2B) the journal holds for that session, 0 if it holds another one. The
+ * next update or configure then tells the host which page to start from, see
+ * journal_open().
+ */
+void handle_journal(void)
+{
+    uint32_t session;
+    uint32_t pages = 0;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'J');
+
+    // Receive the session ID
+    session = ((uint32_t)uart_readb(HOST_UART)) << 24;
+    session |= ((uint32_t)uart_readb(HOST_UART)) << 16;
+    session |= ((uint32_t)uart_readb(HOST_UART)) << 8;
+    session |= (uint32_t)uart_readb(HOST_UART);
+
+    load_session = session;
+    load_resumable = true;
+    if (metadata_read(META_JOURNAL_SESSION) == session) {
+        pages = journal_pages();
+    }
+
+    uart_writeb(HOST_UART, (uint8_t)(pages >> 8));
+    uart_writeb(HOST_UART, (uint8_t)pages);
+}
+
+
+/**
+ * @brief Switch back to the firmware in the other slot.
+ * 
+ * No data is transferred: the other slot becomes active if it holds a
+ * verified image, which is the one installed before the last update, and is
+ * refused with FRAME_BAD otherwise.
+ */
+void handle_rollback(void)
+{
+    uint32_t slot = SLOT_OTHER(slot_active());
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'A');
+
+    if (!metadata_ready || !firmware_verified(slot) || (slot_select(slot) != 0)) {
+        uart_writeb(HOST_UART, FRAME_BAD);
+        return;
+    }
+
+    uart_writeb(HOST_UART, FRAME_OK);
+}
+
+
+/**
+ * @brief Send the address the next update is stored at.
+ * 
+ * This is the storage of the slot that is not active (4B), which an image
+ * executed in place has to be linked for.
+ */
+void handle_target(void)
+{
+    uint32_t address = FIRMWARE_STORAGE_PTR(SLOT_OTHER(slot_active()));
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'T');
+
+    uart_writeb(HOST_UART, (uint8_t)(address >> 24));
+    uart_writeb(HOST_UART, (uint8_t)(address >> 16));
+    uart_writeb(HOST_UART, (uint8_t)(address >> 8));
+    uart_writeb(HOST_UART, (uint8_t)address);
+}
+
+
+/**
+ * @brief Reset the per-session transfer options after a host command.
+ * 
+ * Windows, transfer types, sessions and baud rates negotiated with 'W', 'D',
+ * 'X', 'J' and 'S' only apply to the next update, configure or readback, so
+ * each host tool starts from the defaults. The AES round keys expanded for an update are
+ * wiped with them.
+ */
+static void reset_session(void)
+{
+    load_window = 0;
+    load_mode = LOAD_PAGES;
+    load_resumable = false;
+    journal_active = false;
+    load_finish = NULL;
+    cipher_close();
+
+    if (host_baud != UART_DEFAULT_BAUD) {
+        uart_set_baudrate(HOST_UART, UART_DEFAULT_BAUD);
+        host_baud = UART_DEFAULT_BAUD;
+    }
 }
 
 
@@ -426,8 +2143,21 @@ int main(void) {
     br_sha1_init(&context);
 #endif
 
+    // Initialize the system clock before any divisors are derived from it
+    clock_init();
+
     // Initialize IO components
     uart_init();
+    metadata_ready = (metadata_init() == 0);
+
+#ifdef BENCHMARK
+    bench_init();
+#endif
+
+#ifdef AUTOBOOT_MS
+    // Start a verified firmware unless the host speaks up first
+    autoboot();
+#endif
 
     // Handle host commands
     while (1) {
@@ -436,16 +2166,58 @@ int main(void) {
         switch (cmd) {
         case 'C':
             handle_configure();
+            reset_session();
             break;
         case 'U':
             handle_update();
+            reset_session();
             break;
         case 'R':
             handle_readback();
+            reset_session();
             break;
         case 'B':
             handle_boot();
             break;
+#ifdef BENCHMARK
+        case 'P':
+            bench_report(HOST_UART);
+            break;
+        case 'L':
+            // Load the firmware into the boot RAM without starting it
+            uart_writeb(HOST_UART, load_firmware(slot_active()) == 0 ? FRAME_OK : FRAME_BAD);
+            break;
+#endif
+#ifdef CRYPTO_BENCH
+        case 'K':
+            // The boot RAM holds nothing until the firmware is booted
+            crypto_bench_run(HOST_UART, (uint8_t *)FIRMWARE_BOOT_PTR, FIRMWARE_BOOT_SIZE);
+            break;
+#endif
+        case 'W':
+            handle_window();
+            break;
+        case 'S':
+            handle_baudrate();
+            break;
+        case 'H':
+            handle_manifest();
+            break;
+        case 'D':
+            handle_delta();
+            break;
+        case 'X':
+            handle_patch();
+            break;
+        case 'A':
+            handle_rollback();
+            break;
+        case 'T':
+            handle_target();
+            break;
+        case 'J':
+            handle_journal();
+            break;
         default:
             break;
         }
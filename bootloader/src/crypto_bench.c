@@ -0,0 +1,320 @@
+/**
+ * @file crypto_bench.c
+ * @brief Bootloader crypto microbenchmark implementation.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "driverlib/sysctl.h"
+
+#include "bench.h"
+#include "crypto_bench.h"
+#include "sha256.h"
+#include "uart.h"
+
+#include "aes.h"
+#include "bearssl_block.h"
+#include "bearssl_hash.h"
+
+typedef enum {
+    CRYPTO_BENCH_CBCDEC,    // BearSSL AES-CBC decryption
+    CRYPTO_BENCH_TINY_AES,  // tiny-AES-c AES-CBC decryption
+    CRYPTO_BENCH_CHACHA20,  // ChaCha20 alone
+    CRYPTO_BENCH_POLY1305,  // ChaCha20-Poly1305 opening, as aead_open()
+    CRYPTO_BENCH_HASH,      // BearSSL hash
+} crypto_bench_kind_t;
+
+typedef struct {
+    const char *name;
+    crypto_bench_kind_t kind;
+    const br_block_cbcdec_class *cbcdec;
+    br_chacha20_run chacha20;
+    br_poly1305_run poly1305;
+    const br_hash_class *hash;
+} crypto_bench_t;
+
+static const crypto_bench_t crypto_benches[] = {
+    { "aes_big",          CRYPTO_BENCH_CBCDEC,   .cbcdec = &br_aes_big_cbcdec_vtable },
+    { "aes_small",        CRYPTO_BENCH_CBCDEC,   .cbcdec = &br_aes_small_cbcdec_vtable },
+    { "aes_ct",           CRYPTO_BENCH_CBCDEC,   .cbcdec = &br_aes_ct_cbcdec_vtable },
+    { "tiny_aes",         CRYPTO_BENCH_TINY_AES },
+    { "chacha20_ct",      CRYPTO_BENCH_CHACHA20, .chacha20 = br_chacha20_ct_run },
+    { "poly1305_ctmul",   CRYPTO_BENCH_POLY1305, .poly1305 = br_poly1305_ctmul_run },
+    { "poly1305_ctmul32", CRYPTO_BENCH_POLY1305, .poly1305 = br_poly1305_ctmul32_run },
+    { "md5",              CRYPTO_BENCH_HASH,     .hash = &br_md5_vtable },
+    { "sha1",             CRYPTO_BENCH_HASH,     .hash = &br_sha1_vtable },
+    { "sha256",           CRYPTO_BENCH_HASH,     .hash = &br_sha256_vtable },
+    { "sha256_asm",       CRYPTO_BENCH_HASH,     .hash = &sha256_vtable },
+    { "sha512",           CRYPTO_BENCH_HASH,     .hash = &br_sha512_vtable },
+};
+
+#define CRYPTO_BENCH_COUNT (sizeof(crypto_benches) / sizeof(crypto_benches[0]))
+
+// Any key will do, only the time taken is of interest
+static const uint8_t bench_key[32] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+};
+
+// State of the implementation being measured
+static union {
+    br_aes_gen_cbcdec_keys cbcdec;
+    struct AES_ctx tiny_aes;
+    br_hash_compat_context hash;
+} bench_ctx;
+
+static uint8_t bench_iv[16];
+static uint8_t bench_out[64];
+
+// FIPS 180-2 test vectors
+static const struct {
+    const char *msg;
+    uint8_t hash[32];
+} sha256_kats[] = {
+    { "abc", {
+        0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+        0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad } },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", {
+        0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+        0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1 } },
+};
+
+
+/**
+ * @brief Set up an implementation: key schedule or hash init.
+ */
+static void crypto_bench_setup(const crypto_bench_t *bench)
+{
+    switch (bench->kind) {
+    case CRYPTO_BENCH_CBCDEC:
+        bench->cbcdec->init(&bench_ctx.cbcdec.vtable, bench_key, 16);
+        break;
+    case CRYPTO_BENCH_TINY_AES:
+        AES_init_ctx_iv(&bench_ctx.tiny_aes, bench_key, bench_iv);
+        break;
+    case CRYPTO_BENCH_HASH:
+        bench->hash->init(&bench_ctx.hash.vtable);
+        break;
+    default:
+        // stream ciphers are keyed on every call
+        break;
+    }
+}
+
+
+/**
+ * @brief Run a set up implementation over a buffer.
+ */
+static void crypto_bench_process(const crypto_bench_t *bench, uint8_t *buf, uint32_t len)
+{
+    switch (bench->kind) {
+    case CRYPTO_BENCH_CBCDEC:
+        bench->cbcdec->run(&bench_ctx.cbcdec.vtable, bench_iv, buf, len);
+        break;
+    case CRYPTO_BENCH_TINY_AES:
+        AES_CBC_decrypt_buffer(&bench_ctx.tiny_aes, buf, len);
+        break;
+    case CRYPTO_BENCH_CHACHA20:
+        bench->chacha20(bench_key, bench_iv, 0, buf, len);
+        break;
+    case CRYPTO_BENCH_POLY1305:
+        bench->poly1305(bench_key, bench_iv, buf, len, bench_iv, 6, bench_out,
+                        br_chacha20_ct_run, 0);
+        break;
+    case CRYPTO_BENCH_HASH:
+        bench->hash->update(&bench_ctx.hash.vtable, buf, len);
+        bench->hash->out(&bench_ctx.hash.vtable, bench_out);
+        break;
+    }
+}
+
+
+/**
+ * @brief Check sha256_asm against the known answers, and against BearSSL over
+ * a buffer, fed in uneven parts.
+ *
+ * @return true if every hash matches.
+ */
+static bool crypto_bench_kat(const uint8_t *buf, uint32_t len)
+{
+    br_sha256_context asm_ctx;
+    br_sha256_context ref_ctx;
+    uint8_t ref[32];
+    uint32_t i;
+    uint32_t part;
+
+    for (i = 0; i < sizeof(sha256_kats) / sizeof(sha256_kats[0]); i++) {
+        br_sha256_init(&asm_ctx);
+        sha256_update(&asm_ctx, sha256_kats[i].msg, strlen(sha256_kats[i].msg));
+        sha256_out(&asm_ctx, bench_out);
+        if (memcmp(bench_out, sha256_kats[i].hash, 32) != 0) {
+            return false;
+        }
+    }
+
+    br_sha256_init(&asm_ctx);
+    br_sha256_init(&ref_ctx);
+    for (i = 0, part = 1; i < len; i += part, part = part * 3 + 1) {
+        if (part > len - i) {
+            part = len - i;
+        }
+        sha256_update(&asm_ctx, buf + i, part);
+        br_sha256_update(&ref_ctx, buf + i, part);
+    }
+    sha256_out(&asm_ctx, bench_out);
+    br_sha256_out(&ref_ctx, ref);
+
+    return memcmp(bench_out, ref, 32) == 0;
+}
+
+
+/**
+ * @brief Write a string to a UART interface.
+ */
+static void crypto_bench_puts(uint32_t uart, const char *s)
+{
+    while (*s) {
+        uart_writeb(uart, *s++);
+    }
+}
+
+
+/**
+ * @brief Write a decimal number right aligned in a column.
+ *
+ * @param uart is the base address of the UART interface to write to.
+ * @param value is the number, in tenths if tenths is set.
+ * @param width is the width of the column.
+ * @param tenths adds a decimal point before the last digit.
+ */
+static void crypto_bench_number(uint32_t uart, uint32_t value, uint32_t width, bool tenths)
+{
+    char digits[12];
+    uint32_t n = 0;
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+        if (tenths && (n == 1)) {
+            digits[n++] = '.';
+            if (value == 0) {
+                digits[n++] = '0';
+            }
+        }
+    } while (value > 0);
+
+    while (width-- > n) {
+        uart_writeb(uart, ' ');
+    }
+    while (n > 0) {
+        uart_writeb(uart, digits[--n]);
+    }
+}
+
+
+/**
+ * @brief Write a name left aligned in a column.
+ */
+static void crypto_bench_name(uint32_t uart, const char *name, uint32_t width)
+{
+    for (; *name && width > 0; name++, width--) {
+        uart_writeb(uart, *name);
+    }
+    while (width-- > 0) {
+        uart_writeb(uart, ' ');
+    }
+}
+
+
+/**
+ * @brief Time every vendored cipher and hash implementation and send a table.
+ *
+ * @param uart is the base address of the UART interface to write to.
+ * @param buf is a pointer to a scratch buffer of at least CRYPTO_BENCH_LARGE bytes.
+ * @param size is the size of the scratch buffer.
+ */
+void crypto_bench_run(uint32_t uart, uint8_t *buf, uint32_t size)
+{
+    const crypto_bench_t *bench;
+    uint32_t setup;
+    uint32_t small;
+    uint32_t large;
+    uint32_t start;
+    uint32_t i;
+
+    if (size < CRYPTO_BENCH_LARGE) {
+        uart_writeb(uart, '\0');
+        return;
+    }
+
+    for (i = 0; i < CRYPTO_BENCH_LARGE; i++) {
+        buf[i] = (uint8_t)i;
+    }
+
+    crypto_bench_puts(uart, "clock ");
+    crypto_bench_number(uart, SysCtlClockGet(), 0, false);
+    crypto_bench_puts(uart, " Hz\n");
+    crypto_bench_puts(uart, "impl                 setup     1KB cycles    16KB cycles  cyc/B\n");
+
+    for (i = 0; i < CRYPTO_BENCH_COUNT; i++) {
+        bench = &crypto_benches[i];
+
+        start = bench_now();
+        crypto_bench_setup(bench);
+        setup = bench_now() - start;
+
+        start = bench_now();
+        crypto_bench_process(bench, buf, CRYPTO_BENCH_SMALL);
+        small = bench_now() - start;
+
+        // a fresh setup, so hashes start from their initial state again
+        crypto_bench_setup(bench);
+        start = bench_now();
+        crypto_bench_process(bench, buf, CRYPTO_BENCH_LARGE);
+        large = bench_now() - start;
+
+        crypto_bench_name(uart, bench->name, 17);
+        crypto_bench_number(uart, setup, 9, false);
+        crypto_bench_number(uart, small, 15, false);
+        crypto_bench_number(uart, large, 15, false);
+        crypto_bench_number(uart, (uint32_t)(((uint64_t)large * 10) / CRYPTO_BENCH_LARGE), 7, true);
+        uart_writeb(uart, '\n');
+    }
+
+    // Hashes over more than fits in SRAM, as a boot-time check of flash would
+    crypto_bench_puts(uart, "\nhash over flash           64KB cycles  cyc/B\n");
+    for (i = 0; i < CRYPTO_BENCH_COUNT; i++) {
+        bench = &crypto_benches[i];
+        if (bench->kind != CRYPTO_BENCH_HASH) {
+            continue;
+        }
+
+        crypto_bench_setup(bench);
+        start = bench_now();
+        bench->hash->update(&bench_ctx.hash.vtable, CRYPTO_BENCH_FLASH, CRYPTO_BENCH_HUGE);
+        bench->hash->out(&bench_ctx.hash.vtable, bench_out);
+        large = bench_now() - start;
+
+        crypto_bench_name(uart, bench->name, 26);
+        crypto_bench_number(uart, large, 11, false);
+        crypto_bench_number(uart, (uint32_t)(((uint64_t)large * 10) / CRYPTO_BENCH_HUGE), 7, true);
+        uart_writeb(uart, '\n');
+    }
+
+    crypto_bench_puts(uart, "\nsha256_asm known answers ");
+    crypto_bench_puts(uart, crypto_bench_kat(buf, CRYPTO_BENCH_LARGE) ? "ok\n" : "FAILED\n");
+
+    uart_writeb(uart, '\0');
+}
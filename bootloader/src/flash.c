@@ -19,6 +19,7 @@
 #include "inc/hw_types.h"
 
 #include "flash.h"
+#include "ramfunc.h"
 
 /**
  * @brief Erases a block of flash.
@@ -27,11 +28,27 @@
  * @return 0 on success, or -1 if an invalid block address was specified or the 
  * block is write-protected.
  */
-int32_t flash_erase_page(uint32_t addr)
+RAMFUNC int32_t flash_erase_page(uint32_t addr)
 {
-    // Erase page containing this address
-    return FlashErase(addr & ~(FLASH_PAGE_SIZE - 1));
-} 
+    // Clear the flash access and error interrupts.
+    HWREG(FLASH_FCMISC) = (FLASH_FCMISC_AMISC | FLASH_FCMISC_VOLTMISC | FLASH_FCMISC_ERMISC);
+
+    // Erase page containing this address (same sequence as FlashErase, which
+    // cannot be used from SRAM because it runs from flash)
+    HWREG(FLASH_FMA) = addr & ~(FLASH_PAGE_SIZE - 1);
+    HWREG(FLASH_FMC) = FLASH_FMC_WRKEY | FLASH_FMC_ERASE;
+
+    // Wait for the erase bit to get cleared
+    while(HWREG(FLASH_FMC) & FLASH_FMC_ERASE);
+
+    // Return an error if an access violation or erase error occurred.
+    if(HWREG(FLASH_FCRIS) & (FLASH_FCRIS_ARIS | FLASH_FCRIS_VOLTRIS | FLASH_FCRIS_ERRIS)) {
+        return -1;
+    }
+
+    // Success
+    return 0;
+}
 
 /**
  * @brief Writes a word to flash.
@@ -43,7 +60,7 @@ int32_t flash_erase_page(uint32_t addr)
  * @param addr is the location to write to.
  * @return 0 on success, or -1 if an error occurs.
  */
-int32_t flash_write_word(uint32_t data, uint32_t addr)
+RAMFUNC int32_t flash_write_word(uint32_t data, uint32_t addr)
 {
     // check address is a multiple of 4
     if ((addr & 0x3) != 0) {
@@ -75,20 +92,68 @@ int32_t flash_write_word(uint32_t data, uint32_t addr)
 }
 
 
+/**
+ * @brief Writes a block of words to flash through the flash write buffer.
+ * 
+ * This function fills the 32-word flash write buffer (FWB) and commits it with
+ * a single buffered write operation. The flash address must be aligned to the 
+ * write buffer size (128 bytes).
+ * 
+ * @param data is a pointer to FLASH_FWB_WORDS words to be written.
+ * @param addr is the location to write to.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+RAMFUNC int32_t flash_write_block(uint32_t *data, uint32_t addr)
+{
+    int i;
+
+    // check address is aligned to the write buffer
+    if ((addr & ((FLASH_FWB_WORDS * 4) - 1)) != 0) {
+        return -1;
+    }
+
+    // Clear the flash access and error interrupts.
+    HWREG(FLASH_FCMISC) = (FLASH_FCMISC_AMISC | FLASH_FCMISC_VOLTMISC | FLASH_FCMISC_INVDMISC | FLASH_FCMISC_PROGMISC);
+
+    // Set the address of the block
+    HWREG(FLASH_FMA) = addr & FLASH_FMA_OFFSET_M;
+
+    // Fill the write buffer
+    for (i = 0; i < FLASH_FWB_WORDS; i++) {
+        HWREG(FLASH_FWBN + (i * 4)) = data[i];
+    }
+
+    // Set the memory write key and the buffered write bit
+    HWREG(FLASH_FMC2) = FLASH_FMC2_WRKEY | FLASH_FMC2_WRBUF;
+
+    // Wait for the buffered write bit to get cleared
+    while(HWREG(FLASH_FMC2) & FLASH_FMC2_WRBUF);
+
+    // Return an error if an access violation occurred.
+    if(HWREG(FLASH_FCRIS) & (FLASH_FCRIS_ARIS | FLASH_FCRIS_VOLTRIS | FLASH_FCRIS_INVDRIS | FLASH_FCRIS_PROGRIS)) {
+        return -1;
+    }
+
+    // Success
+    return 0;
+}
+
+
 /**
  * @brief Writes data to flash.
  * 
- * This function writes a sequence of words to flash memory. Because the flash 
- * is written one word at a time, the starting address must be a multiple of 4.
+ * This function writes a sequence of words to flash memory. Whole 32-word 
+ * blocks are programmed through the flash write buffer, and any words before
+ * the first or after the last 128-byte boundary are written one at a time. The
+ * starting address must be a multiple of 4.
  * 
  * @param data is a pointer to the data to be written.
  * @param addr is the starting address in flash to be written to.
  * @param count is the number of words to be written.
  * @return 0 on success, or -1 if an error occurs.
  */
-int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count)
+RAMFUNC int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count)
 {
-    int i;
     int status;
 
     // check address and count are multiples of 4
@@ -97,14 +162,24 @@ int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count)
     }
 
     // Loop over the words to be programmed.
-    for (i = 0; i < count; i++) {
-        status = flash_write_word(data[i], addr);
+    while (count > 0) {
+        if (((addr & ((FLASH_FWB_WORDS * 4) - 1)) == 0) && (count >= FLASH_FWB_WORDS)) {
+            // Aligned whole block, use the write buffer
+            status = flash_write_block(data, addr);
+            data += FLASH_FWB_WORDS;
+            addr += FLASH_FWB_WORDS * 4;
+            count -= FLASH_FWB_WORDS;
+        } else {
+            // Unaligned head or short tail, write a single word
+            status = flash_write_word(*data, addr);
+            data++;
+            addr += 4;
+            count--;
+        }
 
         if (status == -1) {
             return -1;
         }
-
-        addr += 4;
     }
 
     // Success
@@ -0,0 +1,324 @@
+/**
+ * @file lz.c
+ * @brief Bootloader LZ decompression implementation.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lz.h"
+
+typedef enum {
+    LZ_TOKEN,       // receiving a token
+    LZ_LIT_LEN,     // receiving the extension of the literal count
+    LZ_LITERALS,    // receiving literals
+    LZ_OFFSET_LO,   // receiving the low byte of a match offset
+    LZ_OFFSET_HI,   // receiving the high byte of a match offset
+    LZ_MATCH_LEN,   // receiving the extension of the match length
+    LZ_DONE,        // the whole image has been produced
+} lz_state_t;
+
+// State of the image being decompressed, kept between lz_feed() calls
+static struct {
+    const uint8_t *history;
+    uint8_t *page;
+    uint32_t page_size;
+    uint32_t page_start;
+    uint32_t size;
+    uint32_t out_pos;
+    lz_flush_t flush;
+    lz_state_t state;
+    uint32_t literals;
+    uint32_t match;
+    uint32_t offset;
+} lz;
+
+
+/**
+ * @brief Start decompressing an image.
+ *
+ * @param dst is the address the image is stored at.
+ * @param page is a pointer to the buffer that receives the current page.
+ * @param page_size is the size of the page buffer.
+ * @param size is the size of the decompressed image.
+ * @param flush is called with each page of output, or NULL.
+ */
+void lz_begin(uint32_t dst, uint8_t *page, uint32_t page_size, uint32_t size, lz_flush_t flush)
+{
+    lz.history = (const uint8_t *)dst;
+    lz.page = page;
+    lz.page_size = page_size;
+    lz.page_start = 0;
+    lz.size = size;
+    lz.out_pos = 0;
+    lz.flush = flush;
+    lz.state = LZ_TOKEN;
+}
+
+
+/**
+ * @brief Append a byte to the output, flushing the page once it is full.
+ *
+ * @return 0 on success, or -1 if the flush failed.
+ */
+static int32_t lz_put(uint8_t c)
+{
+    lz.page[lz.out_pos++ - lz.page_start] = c;
+
+    if ((lz.flush != NULL) && (lz.out_pos - lz.page_start == lz.page_size)) {
+        if (lz.flush((uint32_t)lz.history + lz.page_start, lz.page) != 0) {
+            return -1;
+        }
+        lz.page_start = lz.out_pos;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Move on once the literals of a sequence are known or done.
+ *
+ * @return 0 on success, or -1 if the literals run past the image.
+ */
+static int32_t lz_literals(void)
+{
+    if (lz.literals > 0) {
+        if (lz.literals > lz.size - lz.out_pos) {
+            return -1;
+        }
+        lz.state = LZ_LITERALS;
+    } else if (lz.out_pos == lz.size) {
+        // the last sequence has no match
+        lz.state = LZ_DONE;
+    } else {
+        lz.state = LZ_OFFSET_LO;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Copy a match once its length is complete.
+ *
+ * @return 0 on success, or -1 if the match leaves the image or a flush failed.
+ */
+static int32_t lz_copy(void)
+{
+    uint32_t from;
+
+    if ((lz.offset == 0) || (lz.offset > lz.out_pos) || (lz.match > lz.size - lz.out_pos)) {
+        return -1;
+    }
+
+    // the source overlaps the output for runs shorter than the match
+    while (lz.match--) {
+        from = lz.out_pos - lz.offset;
+        if (lz_put(from >= lz.page_start ? lz.page[from - lz.page_start] : lz.history[from]) != 0) {
+            return -1;
+        }
+    }
+
+    lz.state = (lz.out_pos == lz.size) ? LZ_DONE : LZ_TOKEN;
+    return 0;
+}
+
+
+/**
+ * @brief Decompress the next part of the stream.
+ *
+ * @param data is a pointer to the compressed bytes.
+ * @param len is the number of compressed bytes.
+ * @return 0 on success, or -1 if the stream is malformed or a flush failed.
+ */
+int32_t lz_feed(const uint8_t *data, uint32_t len)
+{
+    uint8_t c;
+    int32_t error = 0;
+
+    while ((len > 0) && (error == 0)) {
+        c = *data++;
+        len--;
+
+        switch (lz.state) {
+        case LZ_TOKEN:
+            lz.literals = c >> 4;
+            lz.match = (c & 0x0F) + LZ_MIN_MATCH;
+            if (lz.literals == 0x0F) {
+                lz.state = LZ_LIT_LEN;
+            } else {
+                error = lz_literals();
+            }
+            break;
+
+        case LZ_LIT_LEN:
+            lz.literals += c;
+            if (lz.literals > lz.size) {
+                error = -1;
+            } else if (c != 0xFF) {
+                error = lz_literals();
+            }
+            break;
+
+        case LZ_LITERALS:
+            error = lz_put(c);
+            if (--lz.literals == 0) {
+                lz.state = (lz.out_pos == lz.size) ? LZ_DONE : LZ_OFFSET_LO;
+            }
+            break;
+
+        case LZ_OFFSET_LO:
+            lz.offset = c;
+            lz.state = LZ_OFFSET_HI;
+            break;
+
+        case LZ_OFFSET_HI:
+            lz.offset |= (uint32_t)c << 8;
+            if (lz.match == 0x0F + LZ_MIN_MATCH) {
+                lz.state = LZ_MATCH_LEN;
+            } else {
+                error = lz_copy();
+            }
+            break;
+
+        case LZ_MATCH_LEN:
+            lz.match += c;
+            if (lz.match > lz.size) {
+                error = -1;
+            } else if (c != 0xFF) {
+                error = lz_copy();
+            }
+            break;
+
+        case LZ_DONE:
+            // nothing may follow the image
+            error = -1;
+            break;
+        }
+    }
+
+    return error;
+}
+
+
+/**
+ * @brief Finish decompressing, flushing the last page.
+ *
+ * @return 0 on success, or -1 if the stream was incomplete or a flush failed.
+ */
+int32_t lz_finish(void)
+{
+    uint32_t i;
+
+    if ((lz.state != LZ_DONE) || (lz.out_pos != lz.size)) {
+        return -1;
+    }
+
+    // Pad the last page as a full transfer would
+    if ((lz.flush != NULL) && (lz.out_pos > lz.page_start)) {
+        for (i = lz.out_pos - lz.page_start; i < lz.page_size; i++) {
+            lz.page[i] = 0xFF;
+        }
+        return lz.flush((uint32_t)lz.history + lz.page_start, lz.page);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Add the extension of a literal count or match length.
+ *
+ * @param src is the stream position, moved past the extension.
+ * @param end is the end of the stream.
+ * @param n is the count or length to extend.
+ * @return 0 on success, or -1 if the stream ends within the extension.
+ */
+static int32_t lz_length(const uint8_t **src, const uint8_t *end, uint32_t *n)
+{
+    uint8_t c;
+
+    do {
+        if (*src >= end) {
+            return -1;
+        }
+        c = *(*src)++;
+        *n += c;
+    } while (c == 0xFF);
+
+    return 0;
+}
+
+
+/**
+ * @brief Decompress a whole image that is already in memory.
+ *
+ * @param src is a pointer to the compressed image.
+ * @param src_len is the size of the compressed image.
+ * @param dst is a pointer to the buffer that receives the image.
+ * @param size is the size of the decompressed image.
+ * @return 0 on success, or -1 if the stream is malformed.
+ */
+int32_t lz_inflate(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t size)
+{
+    const uint8_t *end = src + src_len;
+    uint8_t *out = dst;
+    uint8_t *out_end = dst + size;
+    const uint8_t *from;
+    uint32_t token;
+    uint32_t n;
+
+    while (src < end) {
+        token = *src++;
+
+        // literals
+        n = token >> 4;
+        if ((n == 0x0F) && (lz_length(&src, end, &n) != 0)) {
+            return -1;
+        }
+        if ((n > (uint32_t)(end - src)) || (n > (uint32_t)(out_end - out))) {
+            return -1;
+        }
+        while (n--) {
+            *out++ = *src++;
+        }
+
+        // the last sequence has no match
+        if (out == out_end) {
+            break;
+        }
+
+        // match
+        if (end - src < 2) {
+            return -1;
+        }
+        n = (uint32_t)src[0] | ((uint32_t)src[1] << 8);
+        src += 2;
+        if ((n == 0) || (n > (uint32_t)(out - dst))) {
+            return -1;
+        }
+        from = out - n;
+
+        n = (token & 0x0F) + LZ_MIN_MATCH;
+        if (((token & 0x0F) == 0x0F) && (lz_length(&src, end, &n) != 0)) {
+            return -1;
+        }
+        if (n > (uint32_t)(out_end - out)) {
+            return -1;
+        }
+        while (n--) {
+            *out++ = *from++;
+        }
+    }
+
+    return ((out == out_end) && (src == end)) ? 0 : -1;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file metadata.c
+ * @brief Bootloader metadata store implementation, in EEPROM words.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driverlib/eeprom.h"
+#include "driverlib/sysctl.h"
+
+#include "metadata.h"
+
+
+/**
+ * @brief Power up the EEPROM and recover from an interrupted write.
+ *
+ * @return 0 on success, or -1 if the EEPROM cannot be used.
+ */
+int32_t metadata_init(void)
+{
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_EEPROM0);
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_EEPROM0));
+
+    return (EEPROMInit() == EEPROM_INIT_OK) ? 0 : -1;
+}
+
+
+/**
+ * @brief Read a metadata word.
+ *
+ * @param addr is the EEPROM address of the word.
+ * @return the word, 0xFFFFFFFF if it was never written.
+ */
+uint32_t metadata_read(uint32_t addr)
+{
+    uint32_t data;
+
+    EEPROMRead(&data, addr, 4);
+    return data;
+}
+
+
+/**
+ * @brief Read consecutive metadata words.
+ *
+ * @param data is a pointer to the destination.
+ * @param addr is the EEPROM address of the first word.
+ * @param count is the number of words.
+ */
+void metadata_read_words(uint32_t *data, uint32_t addr, uint32_t count)
+{
+    EEPROMRead(data, addr, count * 4);
+}
+
+
+/**
+ * @brief Write a metadata word.
+ *
+ * A word that already holds the value is not written again.
+ *
+ * @param data is the value to write.
+ * @param addr is the EEPROM address of the word.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int32_t metadata_write(uint32_t data, uint32_t addr)
+{
+    if ((addr & 0x3) || (addr < METADATA_START) || (addr >= METADATA_END)) {
+        return -1;
+    }
+
+    // Spare the EEPROM a write (and its wear) when nothing changes
+    if (metadata_read(addr) == data) {
+        return 0;
+    }
+
+    return (EEPROMProgram(&data, addr, 4) == 0) ? 0 : -1;
+}
+
+
+/**
+ * @brief Write consecutive metadata words.
+ *
+ * Each word is written on its own, so only the words that change are written.
+ *
+ * @param data is a pointer to the values to write.
+ * @param addr is the EEPROM address of the first word.
+ * @param count is the number of words.
+ * @return 0 on success, or -1 if an error occurs.
+ */
+int32_t metadata_write_words(const uint32_t *data, uint32_t addr, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        if (metadata_write(data[i], addr + i * 4) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file patch.c
+ * @brief Bootloader firmware patch implementation.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "flash.h"
+#include "patch.h"
+
+typedef enum {
+    PATCH_OP,       // receiving an opcode
+    PATCH_ARG,      // receiving the argument of an opcode
+    PATCH_DATA,     // receiving add or insert bytes
+} patch_state_t;
+
+// State of the patch being applied, kept between patch_feed() calls
+static struct {
+    const uint8_t *old;
+    uint32_t old_size;
+    uint32_t old_pos;
+    uint8_t *out;
+    uint32_t new_size;
+    uint32_t out_pos;
+    patch_state_t state;
+    uint8_t op;
+    uint32_t arg;
+    uint32_t arg_shift;
+} patch;
+
+
+/**
+ * @brief Start applying a patch.
+ *
+ * @param old is a pointer to the installed image.
+ * @param old_size is the size of the installed image.
+ * @param out is a pointer to the buffer that receives the new image.
+ * @param new_size is the size of the new image.
+ */
+void patch_begin(const uint8_t *old, uint32_t old_size, uint8_t *out, uint32_t new_size)
+{
+    patch.old = old;
+    patch.old_size = old_size;
+    patch.old_pos = 0;
+    patch.out = out;
+    patch.new_size = new_size;
+    patch.out_pos = 0;
+    patch.state = PATCH_OP;
+}
+
+
+/**
+ * @brief Execute an instruction once its argument is complete.
+ *
+ * @return 0 on success, or -1 if the instruction leaves either image.
+ */
+static int32_t patch_execute(void)
+{
+    uint32_t n = patch.arg;
+    int32_t seek;
+
+    patch.state = PATCH_OP;
+
+    switch (patch.op) {
+    case PATCH_COPY:
+        if ((n > patch.new_size - patch.out_pos) || (n > patch.old_size - patch.old_pos)) {
+            return -1;
+        }
+        while (n--) {
+            patch.out[patch.out_pos++] = patch.old[patch.old_pos++];
+        }
+        return 0;
+
+    case PATCH_ADD:
+        if (n > patch.old_size - patch.old_pos) {
+            return -1;
+        }
+        // fall through, add bytes follow like insert bytes
+    case PATCH_INSERT:
+        if (n > patch.new_size - patch.out_pos) {
+            return -1;
+        }
+        if (n > 0) {
+            patch.state = PATCH_DATA;
+        }
+        return 0;
+
+    case PATCH_SEEK:
+        // zigzag decode
+        seek = (int32_t)(n >> 1) ^ -(int32_t)(n & 1);
+        if (seek < 0) {
+            if ((uint32_t)(-seek) > patch.old_pos) {
+                return -1;
+            }
+        } else if ((uint32_t)seek > patch.old_size - patch.old_pos) {
+            return -1;
+        }
+        patch.old_pos += seek;
+        return 0;
+
+    default:
+        return -1;
+    }
+}
+
+
+/**
+ * @brief Apply the next part of the patch stream.
+ *
+ * @param data is a pointer to the patch bytes.
+ * @param len is the number of patch bytes.
+ * @return 0 on success, or -1 if the patch is malformed.
+ */
+int32_t patch_feed(const uint8_t *data, uint32_t len)
+{
+    uint8_t c;
+
+    while (len > 0) {
+        c = *data++;
+        len--;
+
+        switch (patch.state) {
+        case PATCH_OP:
+            patch.op = c;
+            patch.arg = 0;
+            patch.arg_shift = 0;
+            patch.state = PATCH_ARG;
+            break;
+
+        case PATCH_ARG:
+            // LEB128, at most five bytes for 32 bits
+            if (patch.arg_shift > 28) {
+                return -1;
+            }
+            patch.arg |= (uint32_t)(c & 0x7F) << patch.arg_shift;
+            patch.arg_shift += 7;
+            if (!(c & 0x80) && (patch_execute() != 0)) {
+                return -1;
+            }
+            break;
+
+        case PATCH_DATA:
+            if (patch.op == PATCH_ADD) {
+                c += patch.old[patch.old_pos++];
+            }
+            patch.out[patch.out_pos++] = c;
+            if (--patch.arg == 0) {
+                patch.state = PATCH_OP;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Finish applying a patch.
+ *
+ * @return a pointer to the new image, or NULL if the patch was incomplete.
+ */
+uint8_t *patch_finish(void)
+{
+    uint32_t i;
+
+    if ((patch.state != PATCH_OP) || (patch.out_pos != patch.new_size)) {
+        return NULL;
+    }
+
+    // Pad the last page as a full transfer would
+    for (i = patch.new_size; i % FLASH_PAGE_SIZE; i++) {
+        patch.out[i] = 0xFF;
+    }
+
+    return patch.out;
+}
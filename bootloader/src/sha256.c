@@ -0,0 +1,145 @@
+/**
+ * @file sha256.c
+ * @brief Bootloader SHA-256 implementation, with an assembly compression function.
+ * @date 2022
+ *
+ * This source file is part of an example system for MITRE's 2022 Embedded System CTF (eCTF).
+ * This code is being provided only for educational purposes for the 2022 MITRE eCTF competition,
+ * and may not meet MITRE standards for quality. Use this code at your own risk!
+ *
+ * @copyright Copyright (c) 2022 The MITRE Corporation
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sha256.h"
+
+#define SHA256_BLOCK_SIZE 64
+
+
+/**
+ * @brief Add data to a SHA-256 computation, as br_sha256_update().
+ *
+ * @param ctx is the context.
+ * @param data is a pointer to the data.
+ * @param len is the number of bytes.
+ */
+void sha256_update(br_sha256_context *ctx, const void *data, size_t len)
+{
+    const uint8_t *buf = data;
+    size_t ptr = (size_t)ctx->count & (SHA256_BLOCK_SIZE - 1);
+    size_t clen;
+
+    ctx->count += len;
+
+    // Complete a block left partial by the last call
+    if (ptr != 0) {
+        clen = SHA256_BLOCK_SIZE - ptr;
+        if (clen > len) {
+            clen = len;
+        }
+        memcpy(ctx->buf + ptr, buf, clen);
+        buf += clen;
+        len -= clen;
+        if (ptr + clen < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_block(ctx->val, ctx->buf, 1);
+    }
+
+    // Whole blocks are compressed straight from the data
+    if (len >= SHA256_BLOCK_SIZE) {
+        sha256_block(ctx->val, buf, len / SHA256_BLOCK_SIZE);
+        buf += len & ~(size_t)(SHA256_BLOCK_SIZE - 1);
+        len &= SHA256_BLOCK_SIZE - 1;
+    }
+
+    memcpy(ctx->buf, buf, len);
+}
+
+
+/**
+ * @brief Get the hash of the data added so far, as br_sha256_out().
+ *
+ * @param ctx is the context.
+ * @param out is a pointer to the 32B buffer that receives the hash.
+ */
+void sha256_out(const br_sha256_context *ctx, void *out)
+{
+    uint8_t buf[SHA256_BLOCK_SIZE];
+    uint32_t val[8];
+    uint8_t *dst = out;
+    size_t ptr = (size_t)ctx->count & (SHA256_BLOCK_SIZE - 1);
+    uint64_t bits = ctx->count << 3;
+    int i;
+
+    memcpy(buf, ctx->buf, ptr);
+    memcpy(val, ctx->val, sizeof(val));
+
+    // Pad with a one bit, zeros and the length in bits (big endian)
+    buf[ptr++] = 0x80;
+    if (ptr > SHA256_BLOCK_SIZE - 8) {
+        memset(buf + ptr, 0, SHA256_BLOCK_SIZE - ptr);
+        sha256_block(val, buf, 1);
+        ptr = 0;
+    }
+    memset(buf + ptr, 0, SHA256_BLOCK_SIZE - 8 - ptr);
+    for (i = 0; i < 8; i++) {
+        buf[SHA256_BLOCK_SIZE - 8 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    sha256_block(val, buf, 1);
+
+    for (i = 0; i < 8; i++) {
+        dst[4 * i + 0] = (uint8_t)(val[i] >> 24);
+        dst[4 * i + 1] = (uint8_t)(val[i] >> 16);
+        dst[4 * i + 2] = (uint8_t)(val[i] >> 8);
+        dst[4 * i + 3] = (uint8_t)val[i];
+    }
+}
+
+
+/**
+ * @brief br_hash_class wrappers.
+ */
+static void sha256_vtable_init(const br_hash_class **ctx)
+{
+    br_sha256_init((br_sha256_context *)ctx);
+    *ctx = &sha256_vtable;
+}
+
+static void sha256_vtable_update(const br_hash_class **ctx, const void *data, size_t len)
+{
+    sha256_update((br_sha256_context *)ctx, data, len);
+}
+
+static void sha256_vtable_out(const br_hash_class *const *ctx, void *dst)
+{
+    sha256_out((const br_sha256_context *)ctx, dst);
+}
+
+static uint64_t sha256_vtable_state(const br_hash_class *const *ctx, void *dst)
+{
+    return br_sha256_state((const br_sha256_context *)ctx, dst);
+}
+
+static void sha256_vtable_set_state(const br_hash_class **ctx, const void *stb, uint64_t count)
+{
+    br_sha256_set_state((br_sha256_context *)ctx, stb, count);
+}
+
+const br_hash_class sha256_vtable = {
+    sizeof(br_sha256_context),
+    BR_HASH_DESC_ID(br_sha256_ID)
+        | BR_HASH_DESC_OUT(32)
+        | BR_HASH_DESC_STATE(32)
+        | BR_HASH_DESC_LBLEN(6)
+        | BR_HASH_DESC_MD_PADDING
+        | BR_HASH_DESC_MD_PADDING_BE,
+    sha256_vtable_init,
+    sha256_vtable_update,
+    sha256_vtable_out,
+    sha256_vtable_state,
+    sha256_vtable_set_state,
+};
@@ -15,18 +15,246 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "inc/hw_ints.h"
 #include "inc/hw_memmap.h"
+#include "inc/hw_nvic.h"
 #include "inc/hw_uart.h"
+#include "inc/hw_udma.h"
 #include "inc/hw_types.h"
 #include "driverlib/fpu.h"
 #include "driverlib/gpio.h"
+#include "driverlib/interrupt.h"
 #include "driverlib/pin_map.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/uart.h"
+#include "driverlib/udma.h"
 
+#include "ramfunc.h"
 #include "uart.h"
 
 
+// Host interface receive ring buffer, filled by the UART interrupt handler.
+// The handler only advances rx_head and the readers only advance rx_tail, so
+// no locking is needed between the two.
+static volatile uint8_t rx_buf[UART_RX_BUF_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+// Vector table the bootloader was started with, before UARTIntRegister()
+// moved the vectors into SRAM
+static uint32_t boot_vtable;
+
+// Receive error counters for the host interface
+static volatile uint32_t rx_hw_overruns = 0;
+static volatile uint32_t rx_sw_overruns = 0;
+
+// Background receive requests queued with uart_rx_submit(). Requests are
+// filled strictly in order, and only once the ring buffer has been drained,
+// so the byte stream is never reordered.
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+    volatile uint32_t received;
+} rx_request_t;
+
+static rx_request_t rx_queue[UART_RX_QUEUE_LEN];
+static volatile uint32_t rx_q_head = 0;  // oldest request still receiving
+static volatile uint32_t rx_q_tail = 0;  // next free queue entry
+
+#ifdef UART_DMA
+// Maximum number of items in a single uDMA transfer
+#define UDMA_MAX_XFER 1024
+
+// uDMA channel control table (must be 1024-byte aligned)
+static uint8_t dma_table[1024] __attribute__((aligned(1024)));
+
+static bool rx_dma_active = false;     // uDMA owns the receive FIFO
+static uint32_t rx_dma_req;            // request currently fed to the uDMA
+static uint32_t rx_dma_off;            // bytes of rx_dma_req already armed
+static uint32_t rx_dma_len[2];         // bytes armed per control structure
+static uint32_t rx_dma_owner[2];       // request each control structure fills
+static uint32_t rx_dma_arm_sel;        // next control structure to arm
+static uint32_t rx_dma_done_sel;       // next control structure to complete
+#endif
+
+
+/**
+ * @brief Move bytes from the ring buffer into the pending receive requests.
+ * 
+ * Must be called with the host UART interrupt disabled.
+ */
+static void uart_ring_flush(void)
+{
+    rx_request_t *req;
+
+    while ((rx_head != rx_tail) && (rx_q_head != rx_q_tail)) {
+        req = &rx_queue[rx_q_head];
+        req->buf[req->received++] = rx_buf[rx_tail];
+        rx_tail = (rx_tail + 1) & (UART_RX_BUF_SIZE - 1);
+
+        if (req->received == req->len) {
+            rx_q_head = (rx_q_head + 1) % UART_RX_QUEUE_LEN;
+        }
+    }
+}
+
+
+#ifdef UART_DMA
+/**
+ * @brief Retire completed uDMA transfers and arm the free control structures.
+ * 
+ * Transfers alternate between the primary and alternate control structures of
+ * the ping-pong channel and are split into uDMA-sized chunks, so requests of
+ * any length can be queued. Must be called with the host UART interrupt
+ * disabled.
+ * 
+ * Runs from SRAM as part of the interrupt handler, so the control table and
+ * the uDMA registers are accessed directly rather than through driverlib.
+ */
+static RAMFUNC void uart_dma_service(void)
+{
+    tDMAControlTable *ctl = (tDMAControlTable *)dma_table;
+    uint32_t sel;
+    uint32_t chunk;
+    rx_request_t *req;
+
+    // Credit finished transfers to their requests, in completion order
+    while (rx_dma_len[rx_dma_done_sel] != 0) {
+        sel = rx_dma_done_sel ? UDMA_ALT_SELECT : UDMA_PRI_SELECT;
+        if ((ctl[UDMA_CHANNEL_UART0RX | sel].ui32Control & UDMA_CHCTL_XFERMODE_M) !=
+                UDMA_CHCTL_XFERMODE_STOP) {
+            break;
+        }
+
+        req = &rx_queue[rx_dma_owner[rx_dma_done_sel]];
+        req->received += rx_dma_len[rx_dma_done_sel];
+        if (req->received == req->len) {
+            rx_q_head = (rx_q_head + 1) % UART_RX_QUEUE_LEN;
+        }
+
+        rx_dma_len[rx_dma_done_sel] = 0;
+        rx_dma_done_sel ^= 1;
+    }
+
+    // Bytes still in the ring buffer have to be handed out first
+    if (rx_head != rx_tail) {
+        return;
+    }
+
+    // Arm the free control structures with the next chunks
+    while ((rx_dma_len[rx_dma_arm_sel] == 0) && (rx_dma_req != rx_q_tail)) {
+        req = &rx_queue[rx_dma_req];
+
+        // Skip over whatever was already filled from the ring buffer
+        if (rx_dma_off < req->received) {
+            rx_dma_off = req->received;
+        }
+        if (rx_dma_off == req->len) {
+            rx_dma_req = (rx_dma_req + 1) % UART_RX_QUEUE_LEN;
+            rx_dma_off = 0;
+            continue;
+        }
+
+        chunk = req->len - rx_dma_off;
+        if (chunk > UDMA_MAX_XFER) {
+            chunk = UDMA_MAX_XFER;
+        }
+
+        // Restart a stopped channel on the structure that is next in line
+        if (!(HWREG(UDMA_ENASET) & (1 << UDMA_CHANNEL_UART0RX))) {
+            HWREG(rx_dma_arm_sel ? UDMA_ALTSET : UDMA_ALTCLR) = 1 << UDMA_CHANNEL_UART0RX;
+        }
+
+        // Same as uDMAChannelTransferSet(): the source is the data register,
+        // the destination pointer names the last byte of the chunk
+        sel = rx_dma_arm_sel ? UDMA_ALT_SELECT : UDMA_PRI_SELECT;
+        ctl[UDMA_CHANNEL_UART0RX | sel].pvSrcEndAddr = (void *)(HOST_UART + UART_O_DR);
+        ctl[UDMA_CHANNEL_UART0RX | sel].pvDstEndAddr = req->buf + rx_dma_off + chunk - 1;
+        ctl[UDMA_CHANNEL_UART0RX | sel].ui32Control =
+            (ctl[UDMA_CHANNEL_UART0RX | sel].ui32Control &
+             ~(UDMA_CHCTL_XFERSIZE_M | UDMA_CHCTL_XFERMODE_M)) |
+            UDMA_MODE_PINGPONG | ((chunk - 1) << UDMA_CHCTL_XFERSIZE_S);
+        rx_dma_len[rx_dma_arm_sel] = chunk;
+        rx_dma_owner[rx_dma_arm_sel] = rx_dma_req;
+        rx_dma_arm_sel ^= 1;
+
+        rx_dma_off += chunk;
+        if (rx_dma_off == req->len) {
+            rx_dma_req = (rx_dma_req + 1) % UART_RX_QUEUE_LEN;
+            rx_dma_off = 0;
+        }
+
+        HWREG(UDMA_ENASET) = 1 << UDMA_CHANNEL_UART0RX;
+    }
+}
+#endif
+
+
+/**
+ * @brief Host interface UART interrupt handler.
+ * 
+ * Drains the hardware receive FIFO on both the RX level and the RX timeout
+ * interrupts, so bytes keep arriving while the core is busy erasing or
+ * programming flash. Bytes go straight into the oldest pending receive
+ * request, or into the ring buffer when no request is queued. While the uDMA
+ * owns the FIFO, this handler is entered on transfer completion instead.
+ * 
+ * The handler runs from SRAM and accesses the UART registers directly, so
+ * draining the FIFO is not held off by a flash erase or program operation.
+ */
+static RAMFUNC void uart_host_isr(void)
+{
+    uint32_t status;
+    uint32_t next;
+    uint8_t c;
+    rx_request_t *req;
+
+    // Read and clear the masked interrupt status
+    status = HWREG(HOST_UART + UART_O_MIS);
+    HWREG(HOST_UART + UART_O_ICR) = status;
+
+    // The hardware FIFO overflowed before we could drain it
+    if (status & UART_INT_OE) {
+        rx_hw_overruns++;
+        HWREG(HOST_UART + UART_O_ECR) = 0;
+    }
+
+#ifdef UART_DMA
+    if (rx_dma_active) {
+        // The uDMA keeps filling the other ping-pong buffer even if this
+        // stalls on a flash operation
+        uart_dma_service();
+        return;
+    }
+#endif
+
+    while (!(HWREG(HOST_UART + UART_O_FR) & UART_FR_RXFE)) {
+        c = (uint8_t)(HWREG(HOST_UART + UART_O_DR) & UART_DR_DATA_M);
+
+        // Deliver directly to a waiting request once the ring buffer is empty
+        if ((rx_head == rx_tail) && (rx_q_head != rx_q_tail)) {
+            req = &rx_queue[rx_q_head];
+            req->buf[req->received++] = c;
+            if (req->received == req->len) {
+                rx_q_head = (rx_q_head + 1) % UART_RX_QUEUE_LEN;
+            }
+            continue;
+        }
+
+        next = (rx_head + 1) & (UART_RX_BUF_SIZE - 1);
+
+        // Drop the byte if the reader has fallen a full buffer behind
+        if (next == rx_tail) {
+            rx_sw_overruns++;
+            continue;
+        }
+
+        rx_buf[rx_head] = c;
+        rx_head = next;
+    }
+}
+
+
 /**
  * @brief Initialize the UART interfaces.
  * 
@@ -57,11 +285,257 @@ void uart_init(void)
     GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
 
     // Configure the UARTs for 115,200, 8-N-1 operation.
-    UARTConfigSetExpClk(UART0_BASE, SysCtlClockGet(), 115200,
+    UARTConfigSetExpClk(UART0_BASE, SysCtlClockGet(), UART_DEFAULT_BAUD,
+                        (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
+
+#ifdef UART_DMA
+    // Set up the uDMA controller for background reception on UART 0
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_UDMA);
+    uDMAEnable();
+    uDMAControlBaseSet(dma_table);
+    uDMAChannelAssign(UDMA_CH8_UART0RX);
+    uDMAChannelAttributeDisable(UDMA_CHANNEL_UART0RX, UDMA_ATTR_ALL);
+    uDMAChannelControlSet(UDMA_CHANNEL_UART0RX | UDMA_PRI_SELECT,
+                          UDMA_SIZE_8 | UDMA_SRC_INC_NONE | UDMA_DST_INC_8 | UDMA_ARB_4);
+    uDMAChannelControlSet(UDMA_CHANNEL_UART0RX | UDMA_ALT_SELECT,
+                          UDMA_SIZE_8 | UDMA_SRC_INC_NONE | UDMA_DST_INC_8 | UDMA_ARB_4);
+    UARTFIFOLevelSet(HOST_UART, UART_FIFO_TX4_8, UART_FIFO_RX4_8);
+#endif
+
+    // Feed the host receive ring buffer from the RX and RX timeout interrupts
+    rx_head = 0;
+    rx_tail = 0;
+    rx_q_head = 0;
+    rx_q_tail = 0;
+    boot_vtable = HWREG(NVIC_VTABLE);
+    UARTIntRegister(HOST_UART, uart_host_isr);
+    UARTIntEnable(HOST_UART, UART_INT_RX | UART_INT_RT | UART_INT_OE);
+    IntMasterEnable();
+}
+
+
+/**
+ * @brief Stop interrupt-driven reception on the host interface.
+ * 
+ * Must be called before handing control to the firmware so that it gets the
+ * UART back in a polled state at the default rate. Interrupts are left
+ * disabled, the uDMA controller is turned off and the vector table is moved
+ * back to flash, since the firmware reuses the SRAM that driverlib's copy of
+ * the vectors and the uDMA control table live in.
+ */
+void uart_deinit(void)
+{
+    IntMasterDisable();
+    UARTIntDisable(HOST_UART, UART_INT_RX | UART_INT_RT | UART_INT_OE);
+    UARTIntUnregister(HOST_UART);
+
+#ifdef UART_DMA
+    UARTDMADisable(HOST_UART, UART_DMA_RX);
+    uDMAChannelDisable(UDMA_CHANNEL_UART0RX);
+    rx_dma_active = false;
+    uDMADisable();
+    SysCtlPeripheralDisable(SYSCTL_PERIPH_UDMA);
+#endif
+
+    HWREG(NVIC_VTABLE) = boot_vtable;
+    uart_set_baudrate(HOST_UART, UART_DEFAULT_BAUD);
+}
+
+
+/**
+ * @brief Change the baud rate of a UART interface.
+ * 
+ * Waits for the transmitter to finish sending at the old rate, then programs
+ * the divisors for the new rate from the current system clock (8-N-1).
+ * 
+ * @param uart is the base address of the UART port.
+ * @param baud is the new baud rate.
+ */
+void uart_set_baudrate(uint32_t uart, uint32_t baud)
+{
+    while (UARTBusy(uart));
+
+    UARTConfigSetExpClk(uart, SysCtlClockGet(), baud,
                         (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
 }
 
 
+/**
+ * @brief Get the highest baud rate a UART interface can run at.
+ * 
+ * @return the maximum baud rate for the current system clock.
+ */
+uint32_t uart_max_baudrate(void)
+{
+    // UARTConfigSetExpClk() switches to high-speed mode (8x oversampling)
+    // above UARTClk / 16
+    return SysCtlClockGet() / 8;
+}
+
+
+/**
+ * @brief Read the receive error counters of a UART interface.
+ * 
+ * @param uart is the base address of the UART port.
+ * @param stats is a pointer to the structure to fill in.
+ */
+void uart_rx_stats(uint32_t uart, uart_rx_stats_t *stats)
+{
+    if (uart == HOST_UART) {
+        stats->hw_overruns = rx_hw_overruns;
+        stats->sw_overruns = rx_sw_overruns;
+    } else {
+        stats->hw_overruns = 0;
+        stats->sw_overruns = 0;
+    }
+}
+
+
+/**
+ * @brief Prepare a UART interface for a sequence of background receives.
+ * 
+ * When uDMA support is built in (UART_DMA), the receive FIFO is handed to the
+ * uDMA ping-pong channel until uart_rx_end() is called. Bytes that already
+ * arrived in the ring buffer are delivered to the first requests.
+ * 
+ * @param uart is the base address of the UART port.
+ */
+void uart_rx_begin(uint32_t uart)
+{
+    if (uart != HOST_UART) {
+        return;
+    }
+
+    IntDisable(INT_UART0);
+
+    rx_q_head = 0;
+    rx_q_tail = 0;
+
+#ifdef UART_DMA
+    UARTIntDisable(HOST_UART, UART_INT_RX | UART_INT_RT);
+
+    rx_dma_req = 0;
+    rx_dma_off = 0;
+    rx_dma_len[0] = 0;
+    rx_dma_len[1] = 0;
+    rx_dma_arm_sel = 0;
+    rx_dma_done_sel = 0;
+    rx_dma_active = true;
+
+    uDMAChannelAttributeDisable(UDMA_CHANNEL_UART0RX, UDMA_ATTR_ALL);
+    UARTDMAEnable(HOST_UART, UART_DMA_RX);
+#endif
+
+    IntEnable(INT_UART0);
+}
+
+
+/**
+ * @brief Queue a buffer to be filled in the background.
+ * 
+ * Requests are filled in the order they are submitted. At most
+ * UART_RX_QUEUE_LEN requests can be outstanding, and a handle stays valid
+ * until that many further requests have been submitted.
+ * 
+ * @param uart is the base address of the UART port.
+ * @param buf is a pointer to the destination for the received data.
+ * @param len is the number of bytes to receive.
+ * @return a handle for uart_rx_done(), or -1 if the queue is full.
+ */
+int32_t uart_rx_submit(uint32_t uart, uint8_t *buf, uint32_t len)
+{
+    uint32_t handle;
+    uint32_t next;
+
+    if ((uart != HOST_UART) || (len == 0)) {
+        return -1;
+    }
+
+    IntDisable(INT_UART0);
+
+    handle = rx_q_tail;
+    next = (handle + 1) % UART_RX_QUEUE_LEN;
+    if (next == rx_q_head) {
+        IntEnable(INT_UART0);
+        return -1;
+    }
+
+    rx_queue[handle].buf = buf;
+    rx_queue[handle].len = len;
+    rx_queue[handle].received = 0;
+    rx_q_tail = next;
+
+    uart_ring_flush();
+#ifdef UART_DMA
+    uart_dma_service();
+#endif
+
+    IntEnable(INT_UART0);
+
+    return handle;
+}
+
+
+/**
+ * @brief Check if a background receive has completed.
+ * 
+ * @param uart is the base address of the UART port.
+ * @param handle is the value returned by uart_rx_submit().
+ * @return true if the buffer has been filled.
+ */
+bool uart_rx_done(uint32_t uart, int32_t handle)
+{
+    bool done;
+
+    if ((uart != HOST_UART) || (handle < 0)) {
+        return true;
+    }
+
+    // The uDMA done interrupt normally retires transfers; polling here as well
+    // keeps reception going with the interrupt masked
+    IntDisable(INT_UART0);
+#ifdef UART_DMA
+    if (rx_dma_active) {
+        uart_dma_service();
+    }
+#endif
+    done = rx_queue[handle].received == rx_queue[handle].len;
+    IntEnable(INT_UART0);
+
+    return done;
+}
+
+
+/**
+ * @brief Finish a sequence of background receives.
+ * 
+ * Outstanding requests are cancelled and reception goes back to the ring
+ * buffer.
+ * 
+ * @param uart is the base address of the UART port.
+ */
+void uart_rx_end(uint32_t uart)
+{
+    if (uart != HOST_UART) {
+        return;
+    }
+
+    IntDisable(INT_UART0);
+
+#ifdef UART_DMA
+    UARTDMADisable(HOST_UART, UART_DMA_RX);
+    uDMAChannelDisable(UDMA_CHANNEL_UART0RX);
+    rx_dma_active = false;
+    UARTIntEnable(HOST_UART, UART_INT_RX | UART_INT_RT);
+#endif
+
+    rx_q_head = 0;
+    rx_q_tail = 0;
+
+    IntEnable(INT_UART0);
+}
+
+
 /**
  * @brief Check if there are characters available on a UART interface.
  * 
@@ -71,6 +545,9 @@ void uart_init(void)
  */
 bool uart_avail(uint32_t interface)
 {
+    if (interface == HOST_UART) {
+        return rx_head != rx_tail;
+    }
     return UARTCharsAvail(interface);
 }
 
@@ -83,7 +560,79 @@ bool uart_avail(uint32_t interface)
  */
 int32_t uart_readb(uint32_t uart)
 {
-    return UARTCharGet(uart);
+    uint8_t c;
+
+    if (uart != HOST_UART) {
+        return UARTCharGet(uart);
+    }
+
+    // Wait for the interrupt handler to deliver a byte
+    while (rx_head == rx_tail);
+
+    c = rx_buf[rx_tail];
+    rx_tail = (rx_tail + 1) & (UART_RX_BUF_SIZE - 1);
+
+    return c;
+}
+
+
+/**
+ * @brief Wait for a byte on a UART interface without reading it.
+ * 
+ * @param uart is the base address of the UART port to wait on.
+ * @param timeout_ms is the number of milliseconds to wait for a byte.
+ * @return true if a byte is available, or false on timeout.
+ */
+bool uart_wait(uint32_t uart, uint32_t timeout_ms)
+{
+    // Poll every 100us; SysCtlDelay() takes 3 cycles per loop
+    uint32_t delay = SysCtlClockGet() / 30000;
+    uint32_t polls = timeout_ms * 10;
+
+    while (!uart_avail(uart)) {
+        if (polls == 0) {
+            return false;
+        }
+        polls--;
+        SysCtlDelay(delay);
+    }
+
+    return true;
+}
+
+
+/**
+ * @brief Discard received bytes until a UART interface has been idle for a
+ * while.
+ * 
+ * @param uart is the base address of the UART port to drain.
+ * @param idle_ms is the number of milliseconds without a byte that ends the
+ * drain.
+ */
+void uart_drain(uint32_t uart, uint32_t idle_ms)
+{
+    while (uart_wait(uart, idle_ms)) {
+        while (uart_avail(uart)) {
+            uart_readb(uart);
+        }
+    }
+}
+
+
+/**
+ * @brief Read a byte from a UART interface, giving up after a timeout.
+ * 
+ * @param uart is the base address of the UART port to read from.
+ * @param timeout_ms is the number of milliseconds to wait for a byte.
+ * @return the character read from the interface, or -1 on timeout.
+ */
+int32_t uart_readb_timeout(uint32_t uart, uint32_t timeout_ms)
+{
+    if (!uart_wait(uart, timeout_ms)) {
+        return -1;
+    }
+
+    return uart_readb(uart);
 }
 
 
@@ -9,10 +9,14 @@
 # 2022 MITRE eCTF competition, and may not meet MITRE standards for quality.
 # Use this code at your own risk!
 
+import argparse
 import logging
 from pathlib import Path
 import socket
+import struct
 from sys import stderr
+from typing import Callable, List, Optional
+import zlib
 
 LOG_FORMAT = "%(asctime)s:%(name)-12s%(levelname)-8s %(message)s"
 log = logging.getLogger(Path(__file__).name)
@@ -23,6 +27,47 @@ RELEASE_MESSAGES_ROOT = Path("/messages")
 
 RESP_OK = b"\x00"
 
+# Windowed transfer status codes
+FRAME_OK = 0x00
+FRAME_BAD = 0x01
+FRAME_ABORT = 0x02
+FRAME_SKIPPED = 0x03
+
+# Frames in flight for windowed transfers (the bootloader may grant fewer)
+DEFAULT_WINDOW = 2
+
+# Seconds to wait for an answer to an optional command before falling back
+NEGOTIATE_TIMEOUT = 1.0
+
+# Baud rate negotiation
+DEFAULT_BAUDRATE = 115200
+BAUD_SYNC = b"\x55\xaa\x0f\xf0"
+BAUD_CONFIRM = b"\xc3"
+
+# Flag in the size field of an update or configure: the image is sent compressed
+SIZE_COMPRESSED = 0x80000000
+
+# Flag in the size field of an update: the firmware is stored packed (see
+# pack_firmware()) and inflated by the bootloader when it is booted
+SIZE_PACKED = 0x40000000
+
+# Flag in the size field of an update: every frame is sealed with
+# ChaCha20-Poly1305 (see send_packets())
+SIZE_AEAD = 0x20000000
+
+# Flag in the size field of an update: the firmware is linked to run from its
+# flash address and is booted in place, without a copy into the boot RAM
+SIZE_XIP = 0x10000000
+
+# Size of the firmware storage of a slot, which an XIP image must lie within
+FIRMWARE_STORAGE_SIZE = 0x4000
+
+# LZ4 block format limits
+LZ_MIN_MATCH = 4
+LZ_MAX_OFFSET = 0xFFFF
+LZ_LAST_LITERALS = 5  # the image always ends with literals
+LZ_MATCH_LIMIT = 12  # no match starts closer than this to the end
+
 
 def print_banner(s: str) -> None:
     """Print an underlined string to stdout
@@ -51,13 +96,558 @@ class PacketIterator:
         ].__iter__()
 
 
-def send_packets(sock: socket.socket, data: bytes):
-    packets = PacketIterator(data)
+def recv_exact(sock: socket.socket, n: int) -> bytes:
+    """Receive exactly n bytes from a socket
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        n (int): the number of bytes to receive
+
+    Returns:
+        bytes: the received data
+    """
+    data = b""
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            exit("ERROR: Connection to the bootloader closed")
+        data += chunk
+    return data
+
+
+def negotiate_window(sock: socket.socket, window: int = DEFAULT_WINDOW) -> int:
+    """Ask the bootloader for a windowed transfer on the next command
+
+    Bootloaders without windowed transfer support do not answer, in which case
+    the stop-and-wait protocol is used.
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        window (int): the number of frames to keep in flight
+
+    Returns:
+        int: the granted window, 0 for stop-and-wait
+    """
+    sock.sendall(b"W" + bytes([window]))
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        resp = recv_exact(sock, 2)
+    except socket.timeout:
+        log.info("No window negotiation support, using stop-and-wait")
+        return 0
+    finally:
+        sock.settimeout(None)
+
+    if resp[0:1] != b"W":
+        exit(f"ERROR: Bootloader responded with {repr(resp)}")
+
+    log.info(f"Using a transfer window of {resp[1]} frames")
+    return resp[1]
+
+
+def page_crcs(data: bytes) -> List[int]:
+    """Compute the CRC-32 of each 1KB page of an image as stored in flash
+
+    The bootloader pads the last page with 0xFF.
+
+    Args:
+        data (bytes): the image
+
+    Returns:
+        List[int]: one CRC-32 per page
+    """
+    return [
+        zlib.crc32(page.ljust(PacketIterator.BLOCK_SIZE, b"\xff"))
+        for page in PacketIterator(data)
+    ]
+
+
+def negotiate_delta(
+    sock: socket.socket, region: bytes, data: bytes, window: int
+) -> Optional[List[int]]:
+    """Select a delta transfer of the pages that differ from the device
+
+    The bootloader sends a CRC-32 of every page of the region; only pages of
+    the new image with a different CRC-32 are sent, as addressed frames.
+    Delta transfers need a window, and bootloaders without delta support do
+    not answer, in which case the full image is sent.
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        region (bytes): b"F" for firmware or b"C" for configuration
+        data (bytes): the new image
+        window (int): the window granted by negotiate_window()
+
+    Returns:
+        Optional[List[int]]: the pages to send, or None for a full transfer
+    """
+    if not window:
+        return None
+
+    sock.sendall(b"H")
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        if recv_exact(sock, 1) != b"H":
+            return None
+
+        # Only send the region once the command is known to be supported, an
+        # older bootloader would take b"C" for a configure command
+        sock.sendall(region)
+        if recv_exact(sock, 1) != region:
+            return None
+
+        (count,) = struct.unpack(">H", recv_exact(sock, 2))
+        device_crcs = struct.unpack(f">{count}I", recv_exact(sock, 4 * count))
+    except socket.timeout:
+        log.info("No page manifest support, sending the full image")
+        return None
+    finally:
+        sock.settimeout(None)
+
+    crcs = page_crcs(data)
+    if len(crcs) > count:
+        return None
+    pages = [i for i, crc in enumerate(crcs) if crc != device_crcs[i]]
+
+    sock.sendall(b"D")
+    if recv_exact(sock, 2) != b"D" + RESP_OK:
+        return None
+
+    log.info(f"Sending {len(pages)} of {len(crcs)} pages")
+    return pages
+
+
+def negotiate_patch(sock: socket.socket, base_size: int, base_crc: int) -> bool:
+    """Select a patch transfer against the firmware installed on the device
+
+    The bootloader checks that its firmware is the image the patch was made
+    from. Bootloaders without patch support do not answer, in which case the
+    full image is sent.
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        base_size (int): the size of the image the patch was made from
+        base_crc (int): the CRC-32 of the image the patch was made from
+
+    Returns:
+        bool: True if the device accepted the patch base
+    """
+    sock.sendall(b"X")
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        if recv_exact(sock, 1) != b"X":
+            return False
+    except socket.timeout:
+        log.info("No patch support, sending the full image")
+        return False
+    finally:
+        sock.settimeout(None)
+
+    # Only send the base once the command is known to be supported
+    sock.sendall(struct.pack(">II", base_size, base_crc))
+    if recv_exact(sock, 1) != RESP_OK:
+        log.info("Device firmware is not the patch base, sending the full image")
+        return False
+
+    return True
+
+
+def query_target(sock: socket.socket) -> Optional[int]:
+    """Ask the bootloader where the next update will be stored
+
+    Updates go to the slot that is not active, so an image executed in place
+    has to be linked for the address returned here.
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+
+    Returns:
+        int: the storage address of the next update, or None if the
+            bootloader does not say
+    """
+    sock.sendall(b"T")
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        if recv_exact(sock, 1) != b"T":
+            return None
+        (address,) = struct.unpack(">I", recv_exact(sock, 4))
+    except socket.timeout:
+        return None
+    finally:
+        sock.settimeout(None)
+
+    return address
+
+
+def session_id(*parts: bytes) -> int:
+    """Name a transfer for negotiate_resume() after what it sends
+
+    Args:
+        parts (bytes): the region and contents of the transfer
+
+    Returns:
+        int: a 32-bit session ID, the same every time the transfer is repeated
+    """
+    return zlib.crc32(b"".join(parts))
+
+
+def negotiate_resume(sock: socket.socket, session: int) -> bool:
+    """Name the next update or configure so that it can be resumed
+
+    The bootloader journals the pages of a named transfer as they reach flash.
+    If the link drops, running the same transfer again with the same session
+    resumes it from the first page the device does not hold, which the
+    bootloader sends after acknowledging the header (see recv_resume()).
+    Bootloaders without a journal do not answer, in which case the transfer
+    starts from the beginning as usual.
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        session (int): the session ID, see session_id()
+
+    Returns:
+        bool: True if the transfer is journaled
+    """
+    sock.sendall(b"J")
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        if recv_exact(sock, 1) != b"J":
+            return False
+    except socket.timeout:
+        log.info("No transfer journal support, the transfer cannot be resumed")
+        return False
+    finally:
+        sock.settimeout(None)
+
+    # Only send the session once the command is known to be supported
+    sock.sendall(struct.pack(">I", session))
+    (pages,) = struct.unpack(">H", recv_exact(sock, 2))
+    if pages:
+        log.info(f"Device holds {pages} pages of this transfer")
+    return True
+
+
+def recv_resume(sock: socket.socket) -> int:
+    """Receive the page a journaled transfer starts from
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+
+    Returns:
+        int: the first page to send, 0 unless the transfer is resumed
+    """
+    (first,) = struct.unpack(">H", recv_exact(sock, 2))
+    if first:
+        log.info(f"Resuming the transfer from page {first}")
+    return first
+
+
+def lz_length(n: int) -> bytes:
+    """Encode the extension of an LZ4 literal count or match length"""
+    return b"\xff" * (n // 255) + bytes([n % 255])
+
+
+def lz_compress(data: bytes) -> bytes:
+    """Compress an image in the LZ4 block format decoded by the bootloader
+
+    Greedy matching with a hash of the last position of each 4-byte string,
+    which is plenty for images that are mostly padding and repeated tables.
+
+    Args:
+        data (bytes): the image
+
+    Returns:
+        bytes: the compressed image
+    """
+    out = bytearray()
+    last = {}
+    anchor = 0
+    i = 0
+    limit = len(data) - LZ_MATCH_LIMIT
+
+    while i < limit:
+        key = data[i : i + LZ_MIN_MATCH]
+        cand = last.get(key)
+        last[key] = i
+        if cand is None or i - cand > LZ_MAX_OFFSET:
+            i += 1
+            continue
+
+        length = LZ_MIN_MATCH
+        end = len(data) - LZ_LAST_LITERALS
+        while i + length < end and data[cand + length] == data[i + length]:
+            length += 1
+
+        literals = i - anchor
+        match = length - LZ_MIN_MATCH
+        out.append((min(literals, 15) << 4) | min(match, 15))
+        if literals >= 15:
+            out += lz_length(literals - 15)
+        out += data[anchor:i]
+        out += struct.pack("<H", i - cand)
+        if match >= 15:
+            out += lz_length(match - 15)
+
+        for j in range(i + 1, min(i + length, limit)):
+            last[data[j : j + LZ_MIN_MATCH]] = j
+        i += length
+        anchor = i
+
+    literals = len(data) - anchor
+    out.append(min(literals, 15) << 4)
+    if literals >= 15:
+        out += lz_length(literals - 15)
+    out += data[anchor:]
+    return bytes(out)
+
+
+def pack_firmware(firmware: bytes) -> bytes:
+    """Pack a firmware image to be stored compressed on the device
+
+    A packed image is the unpacked size (4B, little endian) followed by the
+    image in the LZ4 block format.
+
+    Args:
+        firmware (bytes): the firmware image
+
+    Returns:
+        bytes: the packed image
+    """
+    return struct.pack("<I", len(firmware)) + lz_compress(firmware)
+
+
+def set_bridge_baudrate(ctrl_socket: Optional[int], baudrate: int):
+    """Switch the serial side of the serial-socket bridge to a new baud rate
+
+    Args:
+        ctrl_socket (int): port number of the bridge control socket, or None
+            when there is no bridge (emulated devices)
+        baudrate (int): the new baud rate
+    """
+    if ctrl_socket is None:
+        return
+
+    with socket.create_connection(("saffire-net", ctrl_socket)) as ctrl:
+        ctrl.sendall(struct.pack(">I", baudrate))
+        # The bridge answers once the serial port has been switched
+        recv_exact(ctrl, 1)
+
+
+def negotiate_baudrate(
+    sock: socket.socket, baudrate: int, ctrl_socket: Optional[int] = None
+) -> int:
+    """Ask the bootloader to run the next command at a faster baud rate
+
+    The bootloader acknowledges the rate, switches, and waits for the sync
+    pattern at the new rate, which it echoes back, and keeps the rate once the
+    host confirms it saw the echo. If either side misses the sync, both fall
+    back to the default rate.
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        baudrate (int): the proposed baud rate
+        ctrl_socket (int): port number of the bridge control socket for
+            physical devices
+
+    Returns:
+        int: the baud rate in use
+    """
+    sock.sendall(b"S" + str(baudrate).encode() + b"\n")
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        resp = recv_exact(sock, 2)
+    except socket.timeout:
+        log.info("No baud rate negotiation support, using the default rate")
+        return DEFAULT_BAUDRATE
+    finally:
+        sock.settimeout(None)
+
+    if resp != b"S" + RESP_OK:
+        log.info(f"Bootloader cannot run at {baudrate} baud")
+        return DEFAULT_BAUDRATE
+
+    set_bridge_baudrate(ctrl_socket, baudrate)
+
+    # Confirm the new rate
+    sock.sendall(BAUD_SYNC)
+    sock.settimeout(NEGOTIATE_TIMEOUT)
+    try:
+        resp = recv_exact(sock, len(BAUD_SYNC))
+    except socket.timeout:
+        resp = b""
+    finally:
+        sock.settimeout(None)
+
+    if resp != BAUD_SYNC:
+        log.warning(f"No sync at {baudrate} baud, using the default rate")
+        set_bridge_baudrate(ctrl_socket, DEFAULT_BAUDRATE)
+        return DEFAULT_BAUDRATE
+
+    sock.sendall(BAUD_CONFIRM)
+    log.info(f"Running at {baudrate} baud")
+    return baudrate
+
+
+def restore_baudrate(baudrate: int, ctrl_socket: Optional[int] = None):
+    """Return the bridge to the default rate after a negotiated command
+
+    The bootloader drops back to the default rate by itself once the command
+    has completed.
+
+    Args:
+        baudrate (int): the rate returned by negotiate_baudrate()
+        ctrl_socket (int): port number of the bridge control socket
+    """
+    if baudrate != DEFAULT_BAUDRATE:
+        set_bridge_baudrate(ctrl_socket, DEFAULT_BAUDRATE)
+
+
+def add_baudrate_args(parser: argparse.ArgumentParser):
+    """Add the baud rate negotiation options to a host tool
+
+    Args:
+        parser (argparse.ArgumentParser): the tool's argument parser
+    """
+    parser.add_argument(
+        "--baudrate",
+        help="Baud rate to negotiate with the bootloader for this command.",
+        type=int,
+        default=None,
+    )
+    parser.add_argument(
+        "--bridge-ctrl-socket",
+        help="Port number of the serial-socket bridge control socket.",
+        type=int,
+        default=None,
+    )
+
+
+def select_pages(data: bytes, pages: List[int]) -> bytes:
+    """Collect the pages of a delta transfer, each padded to a full page
+
+    Args:
+        data (bytes): the image
+        pages (List[int]): the pages selected by negotiate_delta()
+
+    Returns:
+        bytes: the selected pages
+    """
+    packets = list(PacketIterator(data))
+    return b"".join(
+        packets[page].ljust(PacketIterator.BLOCK_SIZE, b"\xff") for page in pages
+    )
+
+
+def send_packets(
+    sock: socket.socket,
+    data: bytes,
+    window: int = 0,
+    pages: Optional[List[int]] = None,
+    seal: Optional[Callable[[int, bytes], bytes]] = None,
+    first: int = 0,
+):
+    """Send data to the bootloader in 1KB frames
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        data (bytes): the data to send
+        window (int): the window granted by negotiate_window(), 0 for
+            stop-and-wait
+        pages (List[int]): the pages selected by negotiate_delta(), with data
+            holding just those pages (see select_pages()), or None
+        seal (Callable): called with the page index and payload of each frame,
+            returns the payload to send instead (for sealed frames)
+        first (int): the frame to start from, see recv_resume()
+    """
+    if window:
+        send_frames(sock, data, window, pages, seal, first)
+        return
+
+    packets = list(PacketIterator(data))
+    if seal is not None:
+        packets = [seal(num, packet) for num, packet in enumerate(packets)]
 
     for num, packet in enumerate(packets):
+        if num < first:
+            continue
         log.debug(f"Sending Packet {num} ({len(packet)} bytes)...")
         sock.sendall(packet)
         resp = sock.recv(1)  # Wait for an OK from the bootloader
 
         if resp != RESP_OK:
             exit(f"ERROR: Bootloader responded with {repr(resp)}")
+
+
+def send_frames(
+    sock: socket.socket,
+    data: bytes,
+    window: int,
+    pages: Optional[List[int]] = None,
+    seal: Optional[Callable[[int, bytes], bytes]] = None,
+    first: int = 0,
+):
+    """Send data with the windowed (go-back-N) transfer protocol
+
+    Each frame is prefixed with its sequence number, payload length and
+    payload CRC-32. The bootloader acknowledges frames cumulatively once they
+    are in flash, and answers a bad frame with a NAK naming the frame to
+    resend from. Pages that already held the data are acknowledged as skipped.
+
+    In a delta transfer the frame count is sent first, and each frame is a
+    full page with its page index ahead of the header (covered by the CRC-32).
+
+    Args:
+        sock (socket.socket): the socket connected to the bootloader
+        data (bytes): the data to send
+        window (int): the number of frames to keep in flight
+        pages (List[int]): the pages to send as addressed frames, with data
+            holding just those pages (see select_pages()), or None
+        seal (Callable): called with the page index and payload of each frame,
+            returns the payload to send instead (for sealed frames)
+        first (int): the frame to start from, see recv_resume()
+    """
+    packets = list(PacketIterator(data))
+    if seal is not None:
+        indexes = pages if pages is not None else range(len(packets))
+        packets = [seal(index, packet) for index, packet in zip(indexes, packets)]
+    if pages is not None:
+        sock.sendall(struct.pack(">H", len(pages)))
+        packets = [
+            struct.pack(">HH", page, 0) + packet
+            for page, packet in zip(pages, packets)
+        ]
+    base = first
+    next_seq = first
+    skipped = 0
+
+    while base < len(packets):
+        # Fill the window
+        while next_seq < len(packets) and next_seq < base + window:
+            packet = packets[next_seq]
+            if pages is not None:
+                # The page address is covered by the CRC-32 but not the length
+                addr, packet = packet[:4], packet[4:]
+            else:
+                addr = b""
+            log.debug(f"Sending Frame {next_seq} ({len(packet)} bytes)...")
+            crc = zlib.crc32(addr + packet)
+            header = addr + struct.pack(">HHI", next_seq, len(packet), crc)
+            sock.sendall(header + packet)
+            next_seq += 1
+
+        status, seq = struct.unpack(">BH", recv_exact(sock, 3))
+
+        if status == FRAME_OK:
+            base = seq + 1
+        elif status == FRAME_SKIPPED:
+            log.debug(f"Frame {seq} unchanged, not reprogrammed")
+            skipped += 1
+            base = seq + 1
+        elif status == FRAME_BAD:
+            log.warning(f"Bootloader rejected frame {seq}, resending")
+            base = seq
+            next_seq = seq
+        else:
+            exit(f"ERROR: Bootloader aborted the transfer at frame {seq}")
+
+    log.info(f"{skipped} of {len(packets)} pages unchanged")
@@ -310,7 +310,9 @@ def launch_emulator(args, interactive=False, do_gdb=False):
 
 def launch_bootloader_bridge(args):
     # Launch bridge (takes up terminal)
-    serial_socket_bridge.bridge(args.uart_sock, args.serial_port)
+    serial_socket_bridge.bridge(
+        args.uart_sock, args.serial_port, args.bridge_ctrl_sock
+    )
 
 
 def launch_bootloader(args):
@@ -403,6 +405,16 @@ def cfg_protect(args):
     subprocess.run(cmd)
 
 
+def baudrate_args(args):
+    # Optional host tool arguments for a negotiated baud rate
+    if args.baudrate is None:
+        return []
+    tool_args = ["--baudrate", f"{args.baudrate}"]
+    if args.bridge_ctrl_sock is not None:
+        tool_args += ["--bridge-ctrl-socket", f"{args.bridge_ctrl_sock}"]
+    return tool_args
+
+
 def fw_update(args):
     # Need abspath for local folder to mount as a Docker volume
     fw_root = os.path.abspath(args.fw_root)
@@ -423,7 +435,11 @@ def fw_update(args):
         f"rm -rf /secrets; "
         f"/host_tools/fw_update "
         f"--socket {args.uart_sock} "
-        f"--firmware-file {args.protected_fw_file}",
+        f"--firmware-file {args.protected_fw_file} "
+        f"{'--delta ' if args.delta else ''}"
+        f"{'--compress ' if args.compress else ''}"
+        f"{'--pack ' if args.pack else ''}"
+        f"{' '.join(baudrate_args(args))}",
     ]
     subprocess.run(cmd)
 
@@ -448,7 +464,10 @@ def cfg_load(args):
         f"rm -rf /secrets ; "
         f"/host_tools/cfg_load "
         f"--socket {args.uart_sock} "
-        f"--config-file {args.protected_cfg_file}",
+        f"--config-file {args.protected_cfg_file} "
+        f"{'--delta ' if args.delta else ''}"
+        f"{'--compress ' if args.compress else ''}"
+        f"{' '.join(baudrate_args(args))}",
     ]
     subprocess.run(cmd)
 
@@ -473,7 +492,7 @@ def readback(args, rb_region):
         f"{rb_region}",
         "--num-bytes",
         f"{args.rb_len}",
-    ]
+    ] + baudrate_args(args)
     subprocess.run(cmd)
 
 
@@ -543,6 +562,18 @@ def cleanup(args):
     log.info("Removed temporary files")
 
 
+def add_baudrate_args(parser):
+    parser.add_argument(
+        "--baudrate", type=int, default=None, help="Baud rate to negotiate"
+    )
+    parser.add_argument(
+        "--bridge-ctrl-sock",
+        type=int,
+        default=None,
+        help="Bridge control socket for baud rate changes",
+    )
+
+
 def get_args():
     parser = argparse.ArgumentParser(fromfile_prefix_chars="@")
     subparsers = parser.add_subparsers(dest="cmd", help="sub-command help")
@@ -604,6 +635,12 @@ def get_args():
     parser_bl.add_argument("--sock-root", help="Directory to place sockets")
     parser_bl.add_argument("--uart-sock", required=True, help="UART interface socket")
     parser_bl.add_argument("--serial-port", help="Physical device serial port")
+    parser_bl.add_argument(
+        "--bridge-ctrl-sock",
+        type=int,
+        default=None,
+        help="Bridge control socket for baud rate changes (physical only)",
+    )
     bl_group = parser_bl.add_mutually_exclusive_group(required=True)
     bl_group.add_argument(
         "--physical",
@@ -695,6 +732,22 @@ def get_args():
     parser_fw_update.add_argument(
         "--protected-fw-file", required=True, help="Firmware update input file"
     )
+    parser_fw_update.add_argument(
+        "--delta",
+        action="store_true",
+        help="Only send the pages that differ from the device",
+    )
+    parser_fw_update.add_argument(
+        "--compress",
+        action="store_true",
+        help="Send the image compressed",
+    )
+    parser_fw_update.add_argument(
+        "--pack",
+        action="store_true",
+        help="Store the firmware compressed on the device",
+    )
+    add_baudrate_args(parser_fw_update)
     parser_fw_update.set_defaults(func=fw_update)
 
     # Load configuration
@@ -709,6 +762,17 @@ def get_args():
     parser_cfg_load.add_argument(
         "--protected-cfg-file", required=True, help="Configuration load input file"
     )
+    parser_cfg_load.add_argument(
+        "--delta",
+        action="store_true",
+        help="Only send the pages that differ from the device",
+    )
+    parser_cfg_load.add_argument(
+        "--compress",
+        action="store_true",
+        help="Send the image compressed",
+    )
+    add_baudrate_args(parser_cfg_load)
     parser_cfg_load.set_defaults(func=cfg_load)
 
     # Firmware readback
@@ -722,6 +786,7 @@ def get_args():
     parser_fw_readback.add_argument(
         "--rb-len", required=True, help="Readback request data length"
     )
+    add_baudrate_args(parser_fw_readback)
     parser_fw_readback.set_defaults(func=fw_readback)
 
     # Configuration readback
@@ -737,6 +802,7 @@ def get_args():
     parser_cfg_readback.add_argument(
         "--rb-len", required=True, help="Readback request data length"
     )
+    add_baudrate_args(parser_cfg_readback)
     parser_cfg_readback.set_defaults(func=cfg_readback)
 
     # Device boot
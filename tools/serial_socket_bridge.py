@@ -16,6 +16,7 @@ import logging
 import socket
 import select
 import serial
+import struct
 from typing import Optional
 
 
@@ -67,6 +68,18 @@ class Port:
             self.close()
             return False
 
+    def set_baudrate(self, baudrate: int):
+        self.baudrate = baudrate
+        if self.ser:
+            try:
+                # Let queued bytes go out at the old rate before switching
+                self.ser.flush()
+                self.ser.baudrate = baudrate
+                self.ser.reset_input_buffer()
+            except (serial.SerialException, OSError):
+                self.close()
+        self.logger.info(f"Baud rate set to {baudrate} on {self.device_port}")
+
     def close(self):
         self.logger.warning(f"Connection closed on {self.device_port}")
         self.ser = None
@@ -155,15 +168,29 @@ def poll_bridge(host_sock: Sock, device_port: Port):
                 host_sock.send_msg(msg)
 
 
-def bridge(uart_sock: int, device_port: str):
+def poll_ctrl(ctrl_sock: Sock, device_port: Port):
+    if ctrl_sock.active():
+        msg = ctrl_sock.read_msg()
+
+        # Each control message is a 4-byte big-endian baud rate
+        if msg is not None and len(msg) >= 4:
+            (baudrate,) = struct.unpack(">I", msg[:4])
+            device_port.set_baudrate(baudrate)
+            ctrl_sock.send_msg(b"\x00")
+
+
+def bridge(uart_sock: int, device_port: str, ctrl_sock: Optional[int] = None):
 
     # Open all sockets
     uart_sock_obj = Sock(uart_sock)
     device_port_obj = Port(device_port)
+    ctrl_sock_obj = Sock(ctrl_sock) if ctrl_sock is not None else None
 
     # poll socket to serial bridge forever
     while True:
         poll_bridge(uart_sock_obj, device_port_obj)
+        if ctrl_sock_obj is not None:
+            poll_ctrl(ctrl_sock_obj, device_port_obj)
 
 
 # Run in application mode
@@ -181,8 +208,14 @@ if __name__ == "__main__":
         help="Path to host-side data socket (will be created)",
     )
     parser.add_argument("--device-port", required=True, help="Device-side serial port")
+    parser.add_argument(
+        "--ctrl-sock",
+        type=int,
+        default=None,
+        help="Port of host-side control socket for baud rate changes (optional)",
+    )
     args = parser.parse_args()
 
     uart_sock, device_port = args.uart_sock, args.device_port
 
-    bridge(uart_sock, device_port)
+    bridge(uart_sock, device_port, args.ctrl_sock)